@@ -1,6 +1,6 @@
 #include <iostream>
 
-#include <fstream>
+#include "traceReader.h"
 
 #include <vector>
 
@@ -31,7 +31,7 @@ struct Process {
 
 void readProcessData(const string &filename, vector<Process> &processes) {
 
-   ifstream file(filename);
+   TraceReader file(filename);
 
    if (!file) {
 
@@ -44,9 +44,7 @@ void readProcessData(const string &filename, vector<Process> &processes) {
 
    int arrival, id, burst, priority;
 
-   char comma;
-
-   while (file >> arrival >> comma >> id >> comma >> burst >> comma >> priority) {
+   while (file.read(arrival, id, burst, priority)) {
 
    	if (arrival < 0) break;
 
@@ -54,8 +52,6 @@ void readProcessData(const string &filename, vector<Process> &processes) {
 
    }
 
-   file.close();
-
 }
 
 
@@ -1,10 +1,31 @@
 #include <iostream>
-#include <fstream>
 #include <vector>
 #include <queue>
 #include <tuple>
 #include <algorithm>
 #include <iomanip>
+#include <set>
+#include <random>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <array>
+#include <bit>
+#include <concepts>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <mutex>
+#include <new>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "traceReader.h"
 
 using namespace std;
 
@@ -13,6 +34,8 @@ struct Block {
     int start;
     int size;
     bool allocated;
+    int prev = -1;   // neighbouring blocks in address order, -1 at either end
+    int next = -1;
 };
 
 // Structure to represent a memory request
@@ -23,60 +46,829 @@ struct Request {
     int allocated_at = -1; // Default: not allocated
 };
 
-// Class to simulate memory allocation
-class MemoryAllocator {
+// Free blocks ordered by address, for first and next fit. A treap in which every node
+// also keeps the largest free block in its subtree, so whole subtrees with no block
+// big enough are skipped and a search is O(log n). Blocks are identified by the
+// allocator's block number.
+class AddressIndex {
+public:
+    void insert(int block, int start, int size) {
+        int node = new_node(block, start, size);
+        auto [left, right] = split(root, start);
+        root = merge(merge(left, node), right);
+    }
+
+    void erase(int start) {
+        auto [left, rest] = split(root, start);
+        auto [node, right] = split(rest, start + 1);
+        if (node != -1) free_nodes.push_back(node);
+        root = merge(left, right);
+    }
+
+    // Returns the free block of at least size with the lowest start at or after from,
+    // or -1 if there is none. Adds the number of nodes visited to steps.
+    int fit_from(int size, int from, long long& steps) const { return block_of(fit_from(root, from, size, steps)); }
+
 private:
-    int memory_size;
-    vector<Block> blocks;
-    queue<Request> request_queue;
-    int current_time = 0;
-    int next_fit_index = 0;
+    struct Node {
+        int block;
+        int start;
+        int size;
+        int max_size;   // largest size in this subtree
+        unsigned priority;
+        int left = -1;
+        int right = -1;
+    };
+
+    vector<Node> nodes;
+    vector<int> free_nodes;
+    int root = -1;
+    mt19937 random;
+
+    int new_node(int block, int start, int size) {
+        Node node{block, start, size, size, static_cast<unsigned>(random())};
+        if (free_nodes.empty()) {
+            nodes.push_back(node);
+            return nodes.size() - 1;
+        }
+        int index = free_nodes.back();
+        free_nodes.pop_back();
+        nodes[index] = node;
+        return index;
+    }
+
+    int block_of(int node) const { return node == -1 ? -1 : nodes[node].block; }
+
+    int max_size(int node) const { return node == -1 ? INT_MIN : nodes[node].max_size; }
+
+    void update(int node) {
+        Node& n = nodes[node];
+        n.max_size = max(n.size, max(max_size(n.left), max_size(n.right)));
+    }
+
+    // Splits into the nodes with start below key and the rest
+    pair<int, int> split(int node, int key) {
+        if (node == -1) return {-1, -1};
+        if (nodes[node].start < key) {
+            auto [left, right] = split(nodes[node].right, key);
+            nodes[node].right = left;
+            update(node);
+            return {node, right};
+        }
+        auto [left, right] = split(nodes[node].left, key);
+        nodes[node].left = right;
+        update(node);
+        return {left, node};
+    }
+
+    int merge(int left, int right) {
+        if (left == -1) return right;
+        if (right == -1) return left;
+        if (nodes[left].priority > nodes[right].priority) {
+            nodes[left].right = merge(nodes[left].right, right);
+            update(left);
+            return left;
+        }
+        nodes[right].left = merge(left, nodes[right].left);
+        update(right);
+        return right;
+    }
+
+    int fit_from(int node, int from, int size, long long& steps) const {
+        if (max_size(node) < size) return -1;
+        ++steps;
+        const Node& n = nodes[node];
+        if (n.start < from) return fit_from(n.right, from, size, steps);
+        int found = fit_from(n.left, from, size, steps);
+        if (found != -1) return found;
+        if (n.size >= size) return node;
+        return fit_from(n.right, from, size, steps);
+    }
+};
+
+// Free blocks ordered by (size, start), for best and worst fit
+class SizeIndex {
+public:
+    void insert(int block, int start, int size) { by_size.insert({size, start, block}); }
+    void erase(int block, int start, int size) { by_size.erase({size, start, block}); }
+
+    // The smallest block of at least size, or -1
+    int smallest(int size) const {
+        auto it = by_size.lower_bound({size, INT_MIN, INT_MIN});
+        return it == by_size.end() ? -1 : get<2>(*it);
+    }
+
+    // The largest block if it is at least size, or -1
+    int largest(int size) const {
+        if (by_size.empty() || get<0>(*by_size.rbegin()) < size) return -1;
+        return get<2>(*by_size.lower_bound({get<0>(*by_size.rbegin()), INT_MIN, INT_MIN}));
+    }
+
+    bool empty() const { return by_size.empty(); }
+
+    // Levels a lookup descends, about: the set is a balanced tree
+    int depth() const { return bit_width(by_size.size()); }
 
-    // For each strategy, we need to track fragmentation and allocation statistics separately
-    struct StrategyStats {
-        int successful_allocations = 0;
-        int external_fragmentation = 0;
-        int internal_fragmentation = 0;
-        int total_requests = 0;
+private:
+    set<tuple<int, int, int>> by_size;   // size, start, block
+};
+
+// Doubly linked free lists over block numbers, for the size-class policies
+class SegregatedLists {
+public:
+    explicit SegregatedLists(int count) : heads(count, -1) {}
+
+    void insert(int list, int block, int size) {
+        if (block >= static_cast<int>(links.size())) links.resize(block + 1);
+        links[block] = {list, -1, heads[list], size};
+        if (heads[list] != -1) links[heads[list]].prev = block;
+        heads[list] = block;
+    }
+
+    // Returns the list the block was in
+    int erase(int block) {
+        const Link& link = links[block];
+        if (link.prev != -1) links[link.prev].next = link.next;
+        else heads[link.list] = link.next;
+        if (link.next != -1) links[link.next].prev = link.prev;
+        return link.list;
+    }
+
+    int head(int list) const { return heads[list]; }
+    int next(int block) const { return links[block].next; }
+    int size(int block) const { return links[block].size; }
+
+private:
+    struct Link {
+        int list;
+        int prev;
+        int next;
+        int size;
     };
 
-    StrategyStats first_fit_stats;
-    StrategyStats best_fit_stats;
-    StrategyStats worst_fit_stats;
-    StrategyStats next_fit_stats;
+    vector<int> heads;
+    vector<Link> links;   // by block number
+};
 
+// A placement policy owns the index of the free blocks it searches. The allocator
+// tells it about every block that becomes free or stops being free, and asks it for
+// a block of at least size (or -1) on each request, and counts in steps the index
+// nodes or free blocks each search looks at. Policies are template arguments of
+// MemoryAllocator, so the search is inlined into it.
+template <typename Policy>
+concept PlacementPolicy = requires(Policy policy, int block, int start, int size, const vector<Block>& blocks) {
+    { Policy::name } -> convertible_to<const char*>;
+    { policy.steps } -> convertible_to<long long>;
+    policy.insert(block, start, size);
+    policy.erase(block, start, size);
+    { policy.find(size, blocks) } -> same_as<int>;
+};
+
+// First fit: the free block with the lowest address
+struct FirstFit {
+    static constexpr const char* name = "First Fit";
+    AddressIndex free_blocks;
+    long long steps = 0;
+
+    void insert(int block, int start, int size) { free_blocks.insert(block, start, size); }
+    void erase(int, int start, int) { free_blocks.erase(start); }
+    int find(int size, const vector<Block>&) { return free_blocks.fit_from(size, INT_MIN, steps); }
+};
+
+// Best fit: the smallest free block, lowest address first among equals
+struct BestFit {
+    static constexpr const char* name = "Best Fit";
+    SizeIndex free_blocks;
+    long long steps = 0;
+
+    void insert(int block, int start, int size) { free_blocks.insert(block, start, size); }
+    void erase(int block, int start, int size) { free_blocks.erase(block, start, size); }
+    int find(int size, const vector<Block>&) {
+        steps += free_blocks.depth();
+        return free_blocks.smallest(size);
+    }
+};
+
+// Worst fit: the largest free block, lowest address first among equals
+struct WorstFit {
+    static constexpr const char* name = "Worst Fit";
+    SizeIndex free_blocks;
+    long long steps = 0;
+
+    void insert(int block, int start, int size) { free_blocks.insert(block, start, size); }
+    void erase(int block, int start, int size) { free_blocks.erase(block, start, size); }
+    int find(int size, const vector<Block>&) {
+        steps += free_blocks.depth();
+        return free_blocks.largest(size);
+    }
+};
+
+// Next fit: first fit starting from where the last search stopped, wrapping around
+struct NextFit {
+    static constexpr const char* name = "Next Fit";
+    AddressIndex free_blocks;
+    int cursor = 0;   // address the next search resumes from
+    long long steps = 0;
+
+    void insert(int block, int start, int size) { free_blocks.insert(block, start, size); }
+    void erase(int, int start, int) { free_blocks.erase(start); }
+    int find(int size, const vector<Block>& blocks) {
+        int block = free_blocks.fit_from(size, cursor, steps);
+        if (block == -1) block = free_blocks.fit_from(size, INT_MIN, steps);
+        if (block != -1) cursor = blocks[block].start;
+        return block;
+    }
+};
+
+// Segregated fit: sizes are split by power of two and each power of two into 8 size
+// classes, with one free list per class and a bitmap of the classes that are not
+// empty. The first few blocks of the request's own class are tried; every block in a
+// higher class fits, so otherwise the head of the lowest non-empty higher class is
+// taken. Only if there is none is the own class searched, and it is then the highest
+// non-empty class: the classes from it up are kept in a size index from then on,
+// until they are all empty again, so the search is O(log n) and not O(n).
+struct SegregatedFit {
+    static constexpr const char* name = "Segregated Fit";
+    static constexpr int classes = 256;
+    SegregatedLists lists{classes};
+    array<uint64_t, classes / 64> non_empty{};
+    SizeIndex top;            // the free blocks of the classes from indexed_from up
+    int indexed_from = classes;
+    long long steps = 0;
+
+    // Sizes below 16 get a class each
+    static int size_class(int size) {
+        if (size < 8) return size;
+        int log = bit_width(static_cast<unsigned>(size)) - 1;
+        return (log - 2) * 8 + ((size >> (log - 3)) & 7);
+    }
+
+    // The lowest non-empty class above list, or -1
+    int next_non_empty(int list) const {
+        int first = list + 1;
+        for (int word = first / 64; word < classes / 64; ++word) {
+            uint64_t bits = non_empty[word];
+            if (word == first / 64) bits &= ~0ull << (first % 64);
+            if (bits) return word * 64 + countr_zero(bits);
+        }
+        return -1;
+    }
+
+    void insert(int block, int start, int size) {
+        int list = size_class(size);
+        lists.insert(list, block, size);
+        non_empty[list / 64] |= 1ull << (list % 64);
+        if (list >= indexed_from) top.insert(block, start, size);
+    }
+
+    void erase(int block, int start, int size) {
+        int list = lists.erase(block);
+        if (lists.head(list) == -1) non_empty[list / 64] &= ~(1ull << (list % 64));
+        if (list >= indexed_from) {
+            top.erase(block, start, size);
+            if (top.empty()) indexed_from = classes;
+        }
+    }
+
+    static constexpr int probes = 8;
+
+    int find(int size, const vector<Block>& blocks) {
+        int list = size_class(max(size, 1));
+        int block = lists.head(list);
+        ++steps;
+        for (int i = 0; i < probes && block != -1; ++i, block = lists.next(block), ++steps) {
+            if (lists.size(block) >= size) return block;
+        }
+        int higher = next_non_empty(list);
+        if (higher != -1) return lists.head(higher);
+        if (block == -1) return -1;   // the whole class was probed
+        if (list < indexed_from) {
+            // No class above is indexed, as none holds a block: index this one once
+            for (int b = lists.head(list); b != -1; b = lists.next(b), ++steps) {
+                top.insert(b, blocks[b].start, lists.size(b));
+            }
+            indexed_from = list;
+        }
+        steps += top.depth();
+        return top.smallest(size);
+    }
+};
+
+// Two-level segregated fit (TLSF): sizes are split by power of two and each power of
+// two again into 16 ranges, with a bitmap at both levels. A request is rounded up to
+// the start of the next range, so the head of any non-empty range at or above it
+// fits and a block is found in O(1) with two bit scans. The price is that a block
+// just big enough but in the request's own range can be passed over.
+struct TlsfFit {
+    static constexpr const char* name = "TLSF";
+    static constexpr int range_bits = 4;
+    static constexpr int ranges = 1 << range_bits;
+    SegregatedLists lists{32 * ranges};
+    uint32_t first_level = 0;
+    array<uint32_t, 32> second_level{};
+    long long steps = 0;
+
+    // Sizes below 16 get a range each in the first row
+    static pair<int, int> mapping(uint64_t size) {
+        if (size < ranges) return {0, static_cast<int>(size)};
+        int log = bit_width(size) - 1;
+        return {log - range_bits + 1, static_cast<int>((size >> (log - range_bits)) - ranges)};
+    }
+
+    void insert(int block, int, int size) {
+        auto [first, second] = mapping(size);
+        lists.insert(first * ranges + second, block, size);
+        first_level |= 1u << first;
+        second_level[first] |= 1u << second;
+    }
+
+    void erase(int block, int, int) {
+        int list = lists.erase(block);
+        if (lists.head(list) != -1) return;
+        int first = list / ranges;
+        second_level[first] &= ~(1u << (list % ranges));
+        if (second_level[first] == 0) first_level &= ~(1u << first);
+    }
+
+    int find(int size, const vector<Block>&) {
+        ++steps;
+        uint64_t rounded = max(size, 0);
+        if (rounded >= ranges) rounded += (uint64_t{1} << (bit_width(rounded) - 1 - range_bits)) - 1;
+        auto [first, second] = mapping(rounded);
+        if (first >= 32) return -1;
+        uint32_t bits = second_level[first] & (~0u << second);
+        if (bits == 0) {
+            uint32_t higher = first < 31 ? first_level & (~0u << (first + 1)) : 0;
+            if (higher == 0) return -1;
+            first = countr_zero(higher);
+            bits = second_level[first];
+        }
+        return lists.head(first * ranges + countr_zero(bits));
+    }
+};
+
+// The original linear scans over all blocks, kept to check the policies against
+int linear_first_fit(const vector<Block>& blocks, int size) {
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        if (!blocks[i].allocated && blocks[i].size >= size) return i;
+    }
+    return -1;
+}
+
+int linear_best_fit(const vector<Block>& blocks, int size) {
+    int best_index = -1;
+    int min_size_diff = INT_MAX;
+
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        if (!blocks[i].allocated && blocks[i].size >= size) {
+            int size_diff = blocks[i].size - size;
+            if (size_diff < min_size_diff) {
+                min_size_diff = size_diff;
+                best_index = i;
+            }
+        }
+    }
+    return best_index;
+}
+
+int linear_worst_fit(const vector<Block>& blocks, int size) {
+    int worst_index = -1;
+    int max_size_diff = -1;
+
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        if (!blocks[i].allocated && blocks[i].size >= size) {
+            int size_diff = blocks[i].size - size;
+            if (size_diff > max_size_diff) {
+                max_size_diff = size_diff;
+                worst_index = i;
+            }
+        }
+    }
+    return worst_index;
+}
+
+int linear_next_fit(const vector<Block>& blocks, int size, int& next_fit_index) {
+    for (size_t i = 0; i < blocks.size(); ++i) {
+        int index = (next_fit_index + i) % blocks.size();
+        if (!blocks[index].allocated && blocks[index].size >= size) {
+            next_fit_index = index;
+            return index;
+        }
+    }
+    return -1;
+}
+
+// What a compaction moved
+struct Relocation {
+    int blocks = 0;
+    long long size = 0;
+};
+
+// For each strategy, we need to track fragmentation and allocation statistics separately
+struct StrategyStats {
+    int successful_allocations = 0;
+    long long external_fragmentation = 0;
+    long long internal_fragmentation = 0;
+    int total_requests = 0;
+    int compactions = 0;
+    long long blocks_moved = 0;
+    long long units_moved = 0;
+    double compaction_cost = 0;   // in the units of CompactionSettings
+};
+
+// When and how MemoryAllocator compacts its heap. A request that fails while there is
+// enough free space in total compacts it: fully, sliding every allocated block down,
+// or partially, moving only the blocks around one hole until it is big enough. Below a
+// threshold of 1 the heap is also compacted fully every check_interval requests in
+// which its external fragmentation (1 - largest / total free) is above it.
+struct CompactionSettings {
+    enum Mode { None, Partial, Full };
+
+    Mode mode = None;
+    double threshold = 1;
+    int check_interval = 1024;
+
+    // Relocation cost model, in microseconds: a fixed cost per block moved for updating
+    // the references to it, and the copy, per unit (a KB in alloc.dat at 10 GB/s)
+    double cost_per_block = 0.2;
+    double cost_per_unit = 0.1;
+};
+
+// Function to read a trace: the memory size on the first line, then "time size
+// duration" requests up to -1 -1 -1. Returns false if the file cannot be read.
+bool load_trace(const string& file_name, int& memory_size, vector<Request>& trace) {
+    TraceReader file(file_name);
+    if (!file || !file.next(memory_size)) {
+        cerr << "Error: Unable to open file " << file_name << "\n";
+        return false;
+    }
+
+    int time, size, duration;
+    while (file.read(time, size, duration)) {
+        if (time == -1 && size == -1 && duration == -1) break;
+        trace.push_back({time, size, duration});
+    }
+    return true;
+}
+
+// The state of a heap every sample_interval requests, for plotting how a policy
+// degrades over a trace. Step counts and latencies cover the requests since the
+// previous sample.
+struct MetricsSample {
+    int requests = 0;
+    int time = 0;
+    int free_blocks = 0;
+    long long free_total = 0;
+    int largest_free = 0;
+    double external_fragmentation = 0;   // 1 - largest / total free
+    array<int, 32> holes{};              // free blocks by size, [2^i, 2^(i+1)) in holes[i]
+    double steps_per_request = 0;
+    double allocate_ns = 0;              // mean and worst of the timed allocations
+    double allocate_max_ns = 0;
+    double free_ns = 0;                  // mean of the timed frees
+};
+
+// Latency of one kind of operation, timed on one operation in every interval so the
+// clock is read rarely
+struct LatencyWindow {
+    int countdown = 1;
+    int count = 0;
+    double total_ns = 0;
+    double max_ns = 0;
+
+    // True if this operation is the one to time
+    bool due(int interval) {
+        if (interval == 0 || --countdown > 0) return false;
+        countdown = interval;
+        return true;
+    }
+
+    void add(double ns) {
+        ++count;
+        total_ns += ns;
+        max_ns = max(max_ns, ns);
+    }
+
+    double mean() const { return count ? total_ns / count : 0; }
+};
+
+// What the drivers see of an allocator, whatever its policy. Only simulate is
+// virtual, and it is called once per trace, not per request.
+class AllocatorBase {
+public:
+    explicit AllocatorBase(int size) : memory_size(size) {}
+    virtual ~AllocatorBase() = default;
+
+    // Function to replay a trace. The trace is only read, so several allocators can
+    // replay the same one at once. With status_interval, expired blocks are also freed
+    // and the stats recorded whenever the number of requests left is a multiple of it.
+    virtual void simulate(const vector<Request>& trace, int status_interval = 0) = 0;
+    virtual const char* name() const = 0;
+
+    int heap_size() const { return memory_size; }
+    const StrategyStats& final_stats() const { return stats; }
+    const vector<StrategyStats>& status_history() const { return history; }
+
+    // Function to take a MetricsSample every sample_interval requests, timing one
+    // allocation and one free in every latency_interval
+    void enable_metrics(int sample_interval, int latency_interval = 64) {
+        metrics_interval = sample_interval;
+        timing_interval = latency_interval;
+    }
+
+    const vector<MetricsSample>& metrics() const { return samples; }
+
+    // Function to drop the samples taken so far, once they have been written out
+    void clear_metrics() { samples.clear(); }
+
+    void set_compaction(const CompactionSettings& settings) { compaction = settings; }
+
+    void print_status(const StrategyStats& stats) const {
+        cout << "\nAfter " << stats.total_requests << " requests (" << name() << "):\n";
+        cout << "Successful allocations: " << stats.successful_allocations << "\n";
+        cout << "External fragmentation: " << (stats.external_fragmentation * 100.0 / memory_size) << "%\n";
+        cout << "Internal fragmentation: " << (stats.internal_fragmentation * 100.0 / memory_size) << "%\n";
+    }
+
+protected:
+    int memory_size;
+    StrategyStats stats;
+    vector<StrategyStats> history;   // stats at every status point
+    int metrics_interval = 0;
+    int timing_interval = 0;
+    vector<MetricsSample> samples;
+    CompactionSettings compaction;
+
+    // Function to add a compaction and what it moved to the stats
+    void charge(const Relocation& moved) {
+        stats.compactions++;
+        stats.blocks_moved += moved.blocks;
+        stats.units_moved += moved.size;
+        stats.compaction_cost += moved.blocks * compaction.cost_per_block + moved.size * compaction.cost_per_unit;
+    }
+};
+
+// A heap of blocks in address order with one placement policy, in whatever unit of
+// size its owner chooses. The blocks are linked through prev/next: an allocation
+// splits its block and a freed block merges with its free neighbours in O(1). Blocks
+// keep their numbers for as long as they are allocated, even when compaction moves them.
+template <PlacementPolicy Policy>
+class BlockHeap {
 public:
-    explicit MemoryAllocator(int size) : memory_size(size) {
+    // A remainder smaller than this stays with the allocation as internal fragmentation
+    static constexpr int min_fragment = 8;
+
+    explicit BlockHeap(int size) : heap_size(size) {
         blocks.push_back({0, size, false});
+        add_free(0);
     }
 
-    void process_requests(const string& file_name) {
-        ifstream file(file_name);
-        if (!file.is_open()) {
-            cerr << "Error: Unable to open file " << file_name << "\n";
-            return;
+    // Function to allocate a block of at least size. Returns its number, or -1 if no
+    // free block is big enough.
+    int allocate(int size) {
+        int index = policy.find(size, blocks);
+        if (index != -1) split_block(index, size);
+        return index;
+    }
+
+    // Function to free a block and merge it with whichever neighbours are free
+    void free_block(int index) {
+        blocks[index].allocated = false;
+        int next = blocks[index].next;
+        if (next != -1 && !blocks[next].allocated) {
+            remove_free(next);
+            blocks[index].size += blocks[next].size;
+            unlink_block(next);
         }
+        int prev = blocks[index].prev;
+        if (prev != -1 && !blocks[prev].allocated) {
+            remove_free(prev);
+            blocks[prev].size += blocks[index].size;
+            unlink_block(index);
+            index = prev;
+        }
+        add_free(index);
+    }
+
+    // Function to grow an allocated block to size in place, into the free block after
+    // it. Returns false if there is no free block after it or the two are too small.
+    bool extend(int index, int size) {
+        int next = blocks[index].next;
+        if (next == -1 || blocks[next].allocated || blocks[index].size + blocks[next].size < size) return false;
+        remove_free(next);
+        blocks[index].size += blocks[next].size;
+        unlink_block(next);
+        split_rest(index, size);
+        return true;
+    }
 
-        int time, size, duration;
-        while (file >> time >> size >> duration) {
-            if (time == -1 && size == -1 && duration == -1) break;
-            request_queue.push({time, size, duration});
+    // Function to slide every allocated block down to the start of the heap, leaving
+    // one free block at the end. O(blocks).
+    Relocation compact() {
+        Relocation moved;
+        int end = 0;
+        int last = -1;
+        for (int index = first, next; index != -1; index = next) {
+            next = blocks[index].next;
+            if (!blocks[index].allocated) {
+                remove_free(index);
+                unused_blocks.push_back(index);
+                continue;
+            }
+            if (blocks[index].start != end) {
+                moved.blocks++;
+                moved.size += blocks[index].size;
+                blocks[index].start = end;
+            }
+            end += blocks[index].size;
+            blocks[index].prev = last;
+            if (last != -1) blocks[last].next = index;
+            else first = index;
+            last = index;
         }
+        if (end < heap_size) {
+            int rest = new_block({end, heap_size - end, false, last, -1});
+            if (last != -1) blocks[last].next = rest;
+            else first = rest;
+            add_free(rest);
+        } else {
+            blocks[last].next = -1;
+        }
+        return moved;
+    }
 
-        file.close();
-        simulate();
+    // Function to open a free block of at least size without touching the whole heap.
+    // Starting from a hole at least half as big (or a quarter, ...), the allocated
+    // blocks on either side of it are moved into other holes, the smaller first, and
+    // the hole takes in the space they leave, until it is big enough or no neighbour
+    // fits anywhere else. The cost is O(log n) per block moved. Returns the block, or
+    // -1, and adds what was moved to moved even if it did not succeed.
+    int open_hole(int size, Relocation& moved, int max_moves = 64) {
+        if (free_total < size) return -1;
+        int hole = -1;
+        for (int want = (size + 1) / 2; hole == -1 && want > 0; want /= 2) hole = policy.find(want, blocks);
+        if (hole == -1) return -1;
+
+        // The growing hole is held out of the policy, as if allocated, so that it is
+        // neither a target for the blocks moved nor merged with the space they leave
+        remove_free(hole);
+        blocks[hole].allocated = true;
+        for (int moves = 0; blocks[hole].size < size;) {
+            int next = blocks[hole].next;
+            int prev = blocks[hole].prev;
+            if (next != -1 && !blocks[next].allocated) {
+                remove_free(next);
+                blocks[hole].size += blocks[next].size;
+                unlink_block(next);
+                continue;
+            }
+            if (prev != -1 && !blocks[prev].allocated) {
+                remove_free(prev);
+                blocks[prev].allocated = true;
+                blocks[prev].size += blocks[hole].size;
+                unlink_block(hole);
+                hole = prev;
+                continue;
+            }
+            if (moves == max_moves) break;
+
+            int candidates[2] = {next, prev};
+            if (next == -1 || (prev != -1 && blocks[prev].size < blocks[next].size)) swap(candidates[0], candidates[1]);
+            bool relocated = false;
+            for (int candidate : candidates) {
+                if (candidate == -1) continue;
+                int target = policy.find(blocks[candidate].size, blocks);
+                if (target == -1) continue;
+                moved.blocks++;
+                moved.size += blocks[candidate].size;
+                relocate(candidate, target);
+                relocated = true;
+                break;
+            }
+            if (!relocated) break;
+            ++moves;
+        }
+        if (blocks[hole].size < size) {
+            blocks[hole].allocated = false;
+            add_free(hole);
+            return -1;
+        }
+        split_rest(hole, size);
+        return hole;
+    }
+
+    const Block& operator[](int index) const { return blocks[index]; }
+
+    long long search_steps() const { return policy.steps; }
+    long long free_space() const { return free_total; }
+
+    // Function to call f(block) for every block in address order
+    template <typename F>
+    void for_each_block(F f) const {
+        for (int index = first; index != -1; index = blocks[index].next) f(blocks[index]);
+    }
+
+private:
+    vector<Block> blocks;          // block pool; retired slots are reused
+    vector<int> unused_blocks;
+    Policy policy;
+    int heap_size;
+    int first = 0;                 // the block at the start of the heap
+    long long free_total = 0;
+
+    void add_free(int index) {
+        policy.insert(index, blocks[index].start, blocks[index].size);
+        free_total += blocks[index].size;
     }
 
-    void simulate() {
-        while (!request_queue.empty()) {
-            Request request = request_queue.front();
-            request_queue.pop();
-            
-            // Increment the total request count for each strategy
-            first_fit_stats.total_requests++;
-            best_fit_stats.total_requests++;
-            worst_fit_stats.total_requests++;
-            next_fit_stats.total_requests++;
+    void remove_free(int index) {
+        policy.erase(index, blocks[index].start, blocks[index].size);
+        free_total -= blocks[index].size;
+    }
+
+    // Function to allocate the free block index for size
+    void split_block(int index, int size) {
+        remove_free(index);
+        blocks[index].allocated = true;
+        split_rest(index, size);
+    }
+
+    // Function to cut an allocated block down to size, splitting off the rest as a new
+    // free block right after it. The block after it must not be free.
+    void split_rest(int index, int size) {
+        Block& block = blocks[index];
+        if (block.size - size < min_fragment) return;
+
+        int rest = new_block({block.start + size, block.size - size, false, index, block.next});
+        blocks[index].size = size;
+        if (blocks[rest].next != -1) blocks[blocks[rest].next].prev = rest;
+        blocks[index].next = rest;
+        add_free(rest);
+    }
+
+    // Function to move allocated block index into free block target. The block keeps
+    // its number: it swaps places in the list with what is left of the target, which
+    // is then freed.
+    void relocate(int index, int target) {
+        split_block(target, blocks[index].size);
+        swap(blocks[index], blocks[target]);
+        auto renumber = [&](int& link) {
+            if (link == index) link = target;
+            else if (link == target) link = index;
+        };
+        for (int block : {index, target}) {
+            renumber(blocks[block].prev);
+            renumber(blocks[block].next);
+        }
+        for (int block : {index, target}) {
+            if (blocks[block].prev != -1) blocks[blocks[block].prev].next = block;
+            else first = block;
+            if (blocks[block].next != -1) blocks[blocks[block].next].prev = block;
+        }
+        free_block(target);
+    }
+
+    int new_block(const Block& block) {
+        if (unused_blocks.empty()) {
+            blocks.push_back(block);
+            return blocks.size() - 1;
+        }
+        int index = unused_blocks.back();
+        unused_blocks.pop_back();
+        blocks[index] = block;
+        return index;
+    }
+
+    // Function to take a block that was merged into its predecessor out of the list
+    void unlink_block(int index) {
+        const Block& block = blocks[index];
+        if (block.prev != -1) blocks[block.prev].next = block.next;
+        if (block.next != -1) blocks[block.next].prev = block.prev;
+        unused_blocks.push_back(index);
+    }
+};
+
+// Class to simulate memory allocation with one placement policy on a heap of its
+// own. Allocated blocks expire through a min-heap keyed by allocation time plus
+// duration, so advancing the clock only touches the blocks that are due.
+template <PlacementPolicy Policy>
+class MemoryAllocator : public AllocatorBase {
+private:
+    BlockHeap<Policy> heap;
+    priority_queue<pair<int, int>, vector<pair<int, int>>, greater<>> expirations;   // time, block
+    int current_time = 0;
+    LatencyWindow allocate_latency;
+    LatencyWindow free_latency;
+    long long steps_at_sample = 0;   // search steps and requests at the last sample
+    int requests_at_sample = 0;
+
+public:
+    explicit MemoryAllocator(int size) : AllocatorBase(size), heap(size) {}
+
+    void simulate(const vector<Request>& trace, int status_interval = 0) override {
+        for (size_t i = 0; i < trace.size(); ++i) {
+            Request request = trace[i];
+            stats.total_requests++;
 
             // Advance time if needed
             if (request.arrival_time > current_time) {
@@ -84,135 +876,890 @@ public:
                 free_expired_blocks();
             }
 
-            // Attempt allocation using different strategies
-            allocate_memory(request, "First Fit");
-            allocate_memory(request, "Best Fit");
-            allocate_memory(request, "Worst Fit");
-            allocate_memory(request, "Next Fit");
+            allocate_memory(request);
 
-            // Free blocks and print status after every 10 requests
-            if (request_queue.size() % 10 == 0) {
+            if (status_interval > 0 && (trace.size() - i - 1) % status_interval == 0) {
                 free_expired_blocks();
-                print_status("First Fit", first_fit_stats);
-                print_status("Best Fit", best_fit_stats);
-                print_status("Worst Fit", worst_fit_stats);
-                print_status("Next Fit", next_fit_stats);
+                history.push_back(stats);
+            }
+            if (metrics_interval > 0 && stats.total_requests % metrics_interval == 0) take_sample();
+            if (compaction.threshold < 1 && stats.total_requests % compaction.check_interval == 0 &&
+                external_fragmentation() > compaction.threshold) {
+                charge(heap.compact());
             }
         }
     }
 
-    void allocate_memory(Request& request, const string& strategy) {
-        int index = -1;
-        if (strategy == "First Fit") {
-            index = first_fit(request.size);
-        } else if (strategy == "Best Fit") {
-            index = best_fit(request.size);
-        } else if (strategy == "Worst Fit") {
-            index = worst_fit(request.size);
-        } else if (strategy == "Next Fit") {
-            index = next_fit(request.size);
-        }
+    const char* name() const override { return Policy::name; }
 
+    void allocate_memory(Request& request) {
+        if (request.size <= 0) return;   // failed: there is nothing to place
+        int index;
+        timed(allocate_latency, [&] { index = heap.allocate(request.size); });
+        if (index == -1 && compaction.mode != CompactionSettings::None && heap.free_space() >= request.size) {
+            index = compact_for(request.size);
+        }
         if (index != -1) {
-            blocks[index].allocated = true;
-            int internal_frag = blocks[index].size - request.size;
-            if (strategy == "First Fit") {
-                first_fit_stats.successful_allocations++;
-                first_fit_stats.internal_fragmentation += internal_frag;
-            } else if (strategy == "Best Fit") {
-                best_fit_stats.successful_allocations++;
-                best_fit_stats.internal_fragmentation += internal_frag;
-            } else if (strategy == "Worst Fit") {
-                worst_fit_stats.successful_allocations++;
-                worst_fit_stats.internal_fragmentation += internal_frag;
-            } else if (strategy == "Next Fit") {
-                next_fit_stats.successful_allocations++;
-                next_fit_stats.internal_fragmentation += internal_frag;
-            }
-            blocks[index].size = request.size; // Split if needed
+            stats.successful_allocations++;
+            stats.internal_fragmentation += heap[index].size - request.size;
             request.allocated_at = current_time;
+            expirations.push({request.allocated_at + request.duration, index});
         } else {
-            int external_frag = request.size;
-            if (strategy == "First Fit") {
-                first_fit_stats.external_fragmentation += external_frag;
-            } else if (strategy == "Best Fit") {
-                best_fit_stats.external_fragmentation += external_frag;
-            } else if (strategy == "Worst Fit") {
-                worst_fit_stats.external_fragmentation += external_frag;
-            } else if (strategy == "Next Fit") {
-                next_fit_stats.external_fragmentation += external_frag;
-            }
+            stats.external_fragmentation += request.size;
         }
     }
 
-    int first_fit(int size) {
-        for (int i = 0; i < blocks.size(); ++i) {
-            if (!blocks[i].allocated && blocks[i].size >= size) return i;
+    void free_expired_blocks() {
+        while (!expirations.empty() && expirations.top().first <= current_time) {
+            timed(free_latency, [&] { heap.free_block(expirations.top().second); });
+            expirations.pop();
         }
-        return -1;
     }
 
-    int best_fit(int size) {
-        int best_index = -1;
-        int min_size_diff = memory_size + 1;
+private:
+    // Function to run operation, timing it if it is the one due in window
+    template <typename Operation>
+    void timed(LatencyWindow& window, Operation operation) {
+        if (!window.due(timing_interval)) {
+            operation();
+            return;
+        }
+        auto start = chrono::steady_clock::now();
+        operation();
+        window.add(chrono::duration<double, nano>(chrono::steady_clock::now() - start).count());
+    }
+
+    // Function to compact the heap for a request of size that failed. Returns the block
+    // allocated for it, or -1.
+    int compact_for(int size) {
+        Relocation moved;
+        int index;
+        if (compaction.mode == CompactionSettings::Partial) {
+            index = heap.open_hole(size, moved);
+        } else {
+            moved = heap.compact();
+            index = heap.allocate(size);
+        }
+        charge(moved);
+        return index;
+    }
 
-        for (int i = 0; i < blocks.size(); ++i) {
-            if (!blocks[i].allocated && blocks[i].size >= size) {
-                int size_diff = blocks[i].size - size;
-                if (size_diff < min_size_diff) {
-                    min_size_diff = size_diff;
-                    best_index = i;
-                }
+    double external_fragmentation() const {
+        int largest = 0;
+        heap.for_each_block([&](const Block& block) {
+            if (!block.allocated) largest = max(largest, block.size);
+        });
+        return heap.free_space() > 0 ? 1 - double(largest) / heap.free_space() : 0;
+    }
+
+    // Function to walk the heap for a MetricsSample
+    void take_sample() {
+        MetricsSample sample;
+        sample.requests = stats.total_requests;
+        sample.time = current_time;
+        heap.for_each_block([&](const Block& block) {
+            if (block.allocated || block.size <= 0) return;
+            sample.free_blocks++;
+            sample.free_total += block.size;
+            sample.largest_free = max(sample.largest_free, block.size);
+            sample.holes[bit_width(static_cast<unsigned>(block.size)) - 1]++;
+        });
+        if (sample.free_total > 0) sample.external_fragmentation = 1 - double(sample.largest_free) / sample.free_total;
+        sample.steps_per_request = double(heap.search_steps() - steps_at_sample) / (sample.requests - requests_at_sample);
+        sample.allocate_ns = allocate_latency.mean();
+        sample.allocate_max_ns = allocate_latency.max_ns;
+        sample.free_ns = free_latency.mean();
+        samples.push_back(sample);
+
+        steps_at_sample = heap.search_steps();
+        requests_at_sample = sample.requests;
+        allocate_latency = {allocate_latency.countdown};
+        free_latency = {free_latency.countdown};
+    }
+};
+
+// The policies every driver runs, in print order. A new policy only has to be added here.
+template <PlacementPolicy... Policy>
+struct PolicyList {
+    static vector<unique_ptr<AllocatorBase>> make_allocators(int heap_size) {
+        vector<unique_ptr<AllocatorBase>> allocators;
+        (allocators.push_back(make_unique<MemoryAllocator<Policy>>(heap_size)), ...);
+        return allocators;
+    }
+
+    // Function to call f.template operator()<P>() for every policy P
+    static void for_each(auto&& f) { (f.template operator()<Policy>(), ...); }
+};
+
+using Policies = PolicyList<FirstFit, BestFit, WorstFit, NextFit, SegregatedFit, TlsfFit>;
+
+// A malloc-style allocator over real memory with one placement policy. The region is
+// reserved with mmap and a page is only backed once it is touched. A BlockHeap
+// manages it in granules of 16 bytes, so every block is 16-byte aligned. Block
+// headers are kept out of band, in the heap and in an array with the block number of
+// each granule handed out, mapped after the region, so an overrun of one block cannot
+// corrupt another's and freeing an address is a single load.
+//
+// Sizes up to 256 bytes are served from per-thread caches of free blocks, each a
+// bin per size, so most small requests do not take the heap's lock. A cache is
+// refilled and drained half a bin at a time. Blocks in a cache stay allocated in
+// the heap, and a byte per granule, mapped after the block numbers, records the bin
+// of every block that belongs to one, so deallocate can find it without the heap lock.
+template <PlacementPolicy Policy>
+class ArenaAllocator {
+public:
+    static constexpr const char* name = Policy::name;
+    static constexpr size_t granule = 16;
+
+    // Bytes of the region handed out, free, or in use as a whole
+    struct Usage {
+        size_t held = 0;           // in allocated blocks, thread caches included
+        size_t free = 0;
+        size_t largest_free = 0;
+        size_t extent = 0;         // up to the end of the last allocated block
+    };
+
+    explicit ArenaAllocator(size_t bytes) : capacity(granules_in(bytes) * granule), heap(granules_in(bytes)) {
+        void* region = mmap(nullptr, mapped_bytes(), PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (region == MAP_FAILED) throw bad_alloc();
+        base = static_cast<char*>(region);
+        live = reinterpret_cast<int32_t*>(base + capacity);
+        cache_bin = reinterpret_cast<uint8_t*>(live + capacity / granule);
+    }
+
+    ~ArenaAllocator() { munmap(base, mapped_bytes()); }
+
+    ArenaAllocator(const ArenaAllocator&) = delete;
+    ArenaAllocator& operator=(const ArenaAllocator&) = delete;
+
+    // Function to allocate size bytes aligned to align, a power of two. Returns
+    // nullptr if the region has no room.
+    void* allocate(size_t size, size_t align = granule) {
+        if (size > capacity || !has_single_bit(align)) return nullptr;
+        int granules = max<size_t>(1, (size + granule - 1) / granule);
+        if (granules <= cached_sizes && align <= granule) {
+            ThreadCache& cache = thread_cache();
+            lock_guard lock(cache.lock);
+            Bin& bin = cache.bins[granules - 1];
+            if (bin.count == 0) refill(bin, granules);
+            return bin.count == 0 ? nullptr : bin.blocks[--bin.count];
+        }
+        lock_guard lock(heap_lock);
+        return allocate_locked(granules, align);
+    }
+
+    // A pointer that is not in the region is ignored
+    void deallocate(void* pointer) {
+        if (!owns(pointer)) return;
+        int position = (static_cast<char*>(pointer) - base) / granule;
+        if (int bin_number = cache_bin[position]) {
+            ThreadCache& cache = thread_cache();
+            lock_guard lock(cache.lock);
+            Bin& bin = cache.bins[bin_number - 1];
+            if (bin.count == bin_capacity) drain(bin);
+            bin.blocks[bin.count++] = pointer;
+            return;
+        }
+        lock_guard lock(heap_lock);
+        free_locked(position);
+    }
+
+    // Function to resize an allocation, in place if the block, or the block and the
+    // free block after it, is big enough, and otherwise by moving it. Returns nullptr,
+    // leaving the allocation as it was, if there is no room or the pointer is not in
+    // the region.
+    void* reallocate(void* pointer, size_t size) {
+        if (!pointer) return allocate(size);
+        if (!owns(pointer)) return nullptr;
+        if (size == 0) {
+            deallocate(pointer);
+            return nullptr;
+        }
+        int position = (static_cast<char*>(pointer) - base) / granule;
+        int granules = max<size_t>(1, (size + granule - 1) / granule);
+        size_t usable;
+        if (int bin_number = cache_bin[position]) {
+            if (granules <= bin_number) return pointer;
+            usable = bin_number * granule;
+        } else {
+            lock_guard lock(heap_lock);
+            int index = live[position] - 1;
+            if (index < 0) return nullptr;
+            const Block& block = heap[index];
+            int offset = position - block.start;
+            if (offset + granules <= block.size) return pointer;
+            int old_size = block.size;
+            if (heap.extend(index, offset + granules)) {
+                held += (heap[index].size - old_size) * granule;
+                return pointer;
             }
+            usable = (old_size - offset) * granule;
         }
-        return best_index;
+
+        void* moved = allocate(size);
+        if (moved) {
+            memcpy(moved, pointer, min(usable, size));
+            deallocate(pointer);
+        }
+        return moved;
     }
 
-    int worst_fit(int size) {
-        int worst_index = -1;
-        int max_size_diff = -1;
+    // Function to measure how the region is used, by walking the heap
+    Usage usage() {
+        lock_guard lock(heap_lock);
+        Usage usage;
+        usage.held = held;
+        heap.for_each_block([&](const Block& block) {
+            if (block.allocated) {
+                usage.extent = size_t(block.start + block.size) * granule;
+            } else {
+                usage.free += size_t(block.size) * granule;
+                usage.largest_free = max(usage.largest_free, size_t(block.size) * granule);
+            }
+        });
+        return usage;
+    }
 
-        for (int i = 0; i < blocks.size(); ++i) {
-            if (!blocks[i].allocated && blocks[i].size >= size) {
-                int size_diff = blocks[i].size - size;
-                if (size_diff > max_size_diff) {
-                    max_size_diff = size_diff;
-                    worst_index = i;
-                }
+private:
+    static constexpr int cached_sizes = 16;   // 16 to 256 bytes
+    static constexpr int bin_capacity = 32;
+    static constexpr int thread_slots = 64;
+
+    struct Bin {
+        int count = 0;
+        array<void*, bin_capacity> blocks;
+    };
+
+    // Threads take a slot each, round robin; more threads than slots share them
+    struct alignas(64) ThreadCache {
+        mutex lock;
+        array<Bin, cached_sizes> bins;
+    };
+
+    size_t capacity;
+    char* base = nullptr;
+    int32_t* live = nullptr;             // per granule: 1 + block of an address handed out, or 0
+    uint8_t* cache_bin = nullptr;        // per granule: 1 + bin of a cached-size block, or 0
+    mutex heap_lock;                     // guards heap, live and held
+    BlockHeap<Policy> heap;
+    size_t held = 0;
+    unique_ptr<ThreadCache[]> caches = make_unique<ThreadCache[]>(thread_slots);
+
+    bool owns(const void* pointer) const {
+        // As integers: comparing pointers into different objects is unspecified
+        uintptr_t address = reinterpret_cast<uintptr_t>(pointer), start = reinterpret_cast<uintptr_t>(base);
+        return address >= start && address - start < capacity;
+    }
+
+    size_t mapped_bytes() const { return capacity + capacity / granule * (sizeof(int32_t) + 1); }
+
+    static int granules_in(size_t bytes) {
+        if (bytes / granule > INT_MAX) throw length_error("arena larger than the heap can index");
+        return bytes / granule;
+    }
+
+    ThreadCache& thread_cache() {
+        static atomic<int> next_slot{0};
+        thread_local int slot = next_slot++ % thread_slots;
+        return caches[slot];
+    }
+
+    void* allocate_locked(int granules, size_t align) {
+        int padding = align > granule ? (align - granule) / granule : 0;
+        int index = heap.allocate(granules + padding);
+        if (index == -1) return nullptr;
+        uintptr_t address = reinterpret_cast<uintptr_t>(base) + size_t(heap[index].start) * granule;
+        address = (address + align - 1) & ~(align - 1);
+        live[(address - reinterpret_cast<uintptr_t>(base)) / granule] = index + 1;
+        held += size_t(heap[index].size) * granule;
+        return reinterpret_cast<void*>(address);
+    }
+
+    void free_locked(int position) {
+        int index = live[position] - 1;
+        if (index < 0) return;   // freed already
+        held -= size_t(heap[index].size) * granule;
+        heap.free_block(index);
+        live[position] = 0;
+    }
+
+    void refill(Bin& bin, int granules) {
+        lock_guard lock(heap_lock);
+        while (bin.count < bin_capacity / 2) {
+            void* block = allocate_locked(granules, granule);
+            if (!block) return;
+            cache_bin[(static_cast<char*>(block) - base) / granule] = granules;
+            bin.blocks[bin.count++] = block;
+        }
+    }
+
+    void drain(Bin& bin) {
+        lock_guard lock(heap_lock);
+        while (bin.count > bin_capacity / 2) {
+            int position = (static_cast<char*>(bin.blocks[--bin.count]) - base) / granule;
+            cache_bin[position] = 0;
+            free_locked(position);
+        }
+    }
+};
+
+// Heap of alternating free and allocated blocks for the index benchmark. Every request
+// allocates the block its policy picks and frees a random allocated one in exchange,
+// so the number of holes stays the same throughout.
+template <PlacementPolicy Policy>
+struct BenchmarkHeap {
+    vector<Block> blocks;
+    Policy policy;
+    vector<int> allocated;   // indexes of the allocated blocks
+    int next_fit_index = 0;
+    mt19937 random;
+
+    explicit BenchmarkHeap(int holes) : random(holes) {
+        int start = 0;
+        for (int i = 0; i < 2 * holes; ++i) {
+            int size = 1 + random() % 256;
+            bool is_allocated = i % 2 == 1;
+            if (is_allocated) allocated.push_back(blocks.size());
+            else policy.insert(blocks.size(), start, size);
+            blocks.push_back({start, size, is_allocated});
+            start += size;
+        }
+    }
+
+    // The linear scan matching the policy, if it has one
+    static constexpr bool has_linear = is_same_v<Policy, FirstFit> || is_same_v<Policy, BestFit> ||
+                                       is_same_v<Policy, WorstFit> || is_same_v<Policy, NextFit>;
+
+    int find(int size, bool linear) {
+        if (!linear) return policy.find(size, blocks);
+        if constexpr (is_same_v<Policy, FirstFit>) return linear_first_fit(blocks, size);
+        else if constexpr (is_same_v<Policy, BestFit>) return linear_best_fit(blocks, size);
+        else if constexpr (is_same_v<Policy, WorstFit>) return linear_worst_fit(blocks, size);
+        else return linear_next_fit(blocks, size, next_fit_index);
+    }
+
+    void allocate(int index, bool linear) {
+        int& freed = allocated[random() % allocated.size()];
+        blocks[index].allocated = true;
+        blocks[freed].allocated = false;
+        if (!linear) {
+            policy.erase(index, blocks[index].start, blocks[index].size);
+            policy.insert(freed, blocks[freed].start, blocks[freed].size);
+        }
+        freed = index;
+    }
+};
+
+// Function to time count requests on a heap with holes holes, in nanoseconds per request
+template <PlacementPolicy Policy>
+double time_requests(int holes, bool linear, int count) {
+    BenchmarkHeap<Policy> heap(holes);
+    mt19937 sizes(holes);
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < count; ++i) {
+        int index = heap.find(1 + sizes() % 256, linear);
+        if (index != -1) heap.allocate(index, linear);
+    }
+    return chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / count;
+}
+
+// Function to print one row of the index benchmark. A policy with a linear scan is
+// first replayed both ways on the same heap to check that they pick the same block
+// for every request. Returns false on a mismatch.
+template <PlacementPolicy Policy>
+bool benchmark_policy(int holes, int requests) {
+    using Heap = BenchmarkHeap<Policy>;
+    int checked = min(requests, 20000000 / holes);
+    ostringstream linear_ns;
+    linear_ns << "-";
+    if constexpr (Heap::has_linear) {
+        Heap heap(holes);
+        mt19937 sizes(holes);
+        for (int i = 0; i < checked; ++i) {
+            int size = 1 + sizes() % 256;
+            int linear = heap.find(size, true);
+            int indexed = heap.find(size, false);
+            bool cursor_matches = true;
+            if constexpr (is_same_v<Policy, NextFit>) {
+                cursor_matches = linear == -1 || heap.blocks[heap.next_fit_index].start == heap.policy.cursor;
+            }
+            if (linear != indexed || !cursor_matches) {
+                cerr << "Mismatch: " << Policy::name << " with " << holes << " holes, request " << i
+                     << ": linear " << linear << ", indexed " << indexed << "\n";
+                return false;
             }
+            if (indexed != -1) heap.allocate(indexed, false);
         }
-        return worst_index;
+        linear_ns.str("");
+        linear_ns << time_requests<Policy>(holes, true, checked);
     }
+    cout << left << setw(10) << holes << setw(16) << Policy::name << setw(15) << linear_ns.str()
+         << time_requests<Policy>(holes, false, requests) << "\n";
+    return true;
+}
 
-    int next_fit(int size) {
-        for (int i = 0; i < blocks.size(); ++i) {
-            int index = (next_fit_index + i) % blocks.size();
-            if (!blocks[index].allocated && blocks[index].size >= size) {
-                next_fit_index = index;
-                return index;
+// Function to compare the linear scans with the policies' indexes as the number of
+// holes grows
+void run_index_benchmark() {
+    cout << "holes     policy          linear ns/req  indexed ns/req\n";
+    for (int holes : {1000, 10000, 100000, 1000000}) {
+        bool matched = benchmark_policy<FirstFit>(holes, 100000) && benchmark_policy<BestFit>(holes, 100000) &&
+                       benchmark_policy<WorstFit>(holes, 100000) && benchmark_policy<NextFit>(holes, 100000) &&
+                       benchmark_policy<SegregatedFit>(holes, 100000) && benchmark_policy<TlsfFit>(holes, 100000);
+        if (!matched) return;
+    }
+}
+
+// Function to replay one trace on every allocator, each on its own thread, with at
+// most threads of them running at a time. The trace is shared read-only.
+void run_allocators(const vector<Request>& trace, vector<unique_ptr<AllocatorBase>>& allocators, int threads,
+                    int status_interval = 0) {
+    atomic<size_t> next{0};
+    auto worker = [&] {
+        for (size_t i = next++; i < allocators.size(); i = next++) allocators[i]->simulate(trace, status_interval);
+    };
+    vector<thread> workers;
+    for (int i = 1; i < min<int>(threads, allocators.size()); ++i) workers.emplace_back(worker);
+    worker();
+    for (auto& t : workers) t.join();
+}
+
+// Function to build a synthetic trace of count requests for heaps of about 1 MB
+vector<Request> synthetic_trace(int count) {
+    mt19937 random(count);
+    vector<Request> trace;
+    int time = 0;
+    for (int i = 0; i < count; ++i) {
+        time += random() % 2;
+        trace.push_back({time, 1 + static_cast<int>(random() % 4096), 1 + static_cast<int>(random() % 1000)});
+    }
+    return trace;
+}
+
+// Function to time whole simulations of synthetic traces of growing length with every
+// policy, to check that the cost per request stays flat
+void run_replay_benchmark() {
+    cout << "\nrequests  policy          seconds     requests/sec  allocated\n";
+    for (int count : {10000, 100000, 1000000}) {
+        vector<Request> trace = synthetic_trace(count);
+        for (auto& allocator : Policies::make_allocators(1 << 20)) {
+            auto start = chrono::steady_clock::now();
+            allocator->simulate(trace);
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            cout << left << setw(10) << count << setw(16) << allocator->name() << setw(12) << seconds << setw(14)
+                 << static_cast<long>(count / seconds) << allocator->final_stats().successful_allocations << "\n";
+        }
+    }
+}
+
+// Function to sweep every policy over several heap sizes on one synthetic trace,
+// timing the sweep with 1, 2, 4, ... threads up to max_threads
+void run_sweep(int count, int max_threads) {
+    vector<Request> trace = synthetic_trace(count);
+    const int heap_sizes[] = {1 << 18, 1 << 19, 1 << 20, 1 << 21};
+    auto make_allocators = [&] {
+        vector<unique_ptr<AllocatorBase>> allocators;
+        for (int heap_size : heap_sizes) {
+            for (auto& allocator : Policies::make_allocators(heap_size)) allocators.push_back(move(allocator));
+        }
+        return allocators;
+    };
+
+    cout << "threads   seconds     requests/sec\n";
+    vector<unique_ptr<AllocatorBase>> allocators;
+    for (int threads = 1;; threads = min(threads * 2, max_threads)) {
+        allocators = make_allocators();
+        auto start = chrono::steady_clock::now();
+        run_allocators(trace, allocators, threads);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << left << setw(10) << threads << setw(12) << seconds
+             << static_cast<long>(count * allocators.size() / seconds) << "\n";
+        if (threads == max_threads) break;
+    }
+
+    cout << "\nheap      policy          allocated   failed      external frag  internal frag\n";
+    for (const auto& allocator : allocators) {
+        const StrategyStats& stats = allocator->final_stats();
+        cout << left << setw(10) << allocator->heap_size() << setw(16) << allocator->name() << setw(12)
+             << stats.successful_allocations << setw(12) << stats.total_requests - stats.successful_allocations
+             << setw(15) << stats.external_fragmentation * 100.0 / allocator->heap_size()
+             << stats.internal_fragmentation * 100.0 / allocator->heap_size() << "\n";
+    }
+}
+
+// Function to write a CSV header for metrics of heaps of heap_size
+void write_metrics_header(ostream& out, int heap_size) {
+    out << "policy,requests,time,free_blocks,free_total,largest_free,external_fragmentation,"
+           "steps_per_request,allocate_ns,allocate_max_ns,free_ns";
+    for (int i = 0; i < static_cast<int>(bit_width(static_cast<unsigned>(heap_size))); ++i) out << ",holes_" << (1u << i);
+    out << "\n";
+}
+
+// Function to write the metrics samples of every allocator as CSV rows and drop them
+void write_metrics(ostream& out, vector<unique_ptr<AllocatorBase>>& allocators) {
+    for (auto& allocator : allocators) {
+        for (const MetricsSample& sample : allocator->metrics()) {
+            out << allocator->name() << ',' << sample.requests << ',' << sample.time << ',' << sample.free_blocks << ','
+                << sample.free_total << ',' << sample.largest_free << ',' << sample.external_fragmentation << ','
+                << sample.steps_per_request << ',' << sample.allocate_ns << ',' << sample.allocate_max_ns << ','
+                << sample.free_ns;
+            for (int i = 0; i < static_cast<int>(bit_width(static_cast<unsigned>(allocator->heap_size()))); ++i) {
+                out << ',' << sample.holes[i];
             }
+            out << '\n';
         }
-        return -1;
+        allocator->clear_metrics();
     }
+}
 
-    void free_expired_blocks() {
-        for (auto& block : blocks) {
-            if (block.allocated && current_time >= block.start + block.size) {
-                block.allocated = false;
+// Function to print the last metrics sample of every allocator
+void print_metrics_summary(const vector<unique_ptr<AllocatorBase>>& allocators) {
+    cout << "\npolicy          free blocks  largest free  external frag  steps/req   allocate ns  free ns\n";
+    for (const auto& allocator : allocators) {
+        if (allocator->metrics().empty()) continue;
+        const MetricsSample& sample = allocator->metrics().back();
+        cout << left << setw(16) << allocator->name() << setw(13) << sample.free_blocks << setw(14)
+             << sample.largest_free << setw(15) << sample.external_fragmentation << setw(12)
+             << sample.steps_per_request << setw(13) << sample.allocate_ns << sample.free_ns << "\n";
+    }
+}
+
+// Function to replay a synthetic trace of count requests on 1 MB heaps with metrics
+// sampled every interval requests, writing them to metrics_file
+void run_metrics(int count, const string& metrics_file, int interval, int threads) {
+    ofstream out(metrics_file);
+    if (!out) {
+        cerr << "Error: Unable to write " << metrics_file << "\n";
+        return;
+    }
+    vector<Request> trace = synthetic_trace(count);
+    vector<unique_ptr<AllocatorBase>> allocators = Policies::make_allocators(1 << 20);
+    for (auto& allocator : allocators) allocator->enable_metrics(interval);
+    run_allocators(trace, allocators, threads);
+
+    print_metrics_summary(allocators);
+    write_metrics_header(out, 1 << 20);
+    write_metrics(out, allocators);
+    cout << "\nMetrics every " << interval << " requests written to " << metrics_file << "\n";
+}
+
+// Function to replay a trace file of any length with every policy, in the format of
+// alloc.dat. Requests are read and replayed a chunk at a time, so memory use does not
+// grow with the trace. With a metrics_file, metrics are sampled every interval requests
+// and written out after every chunk.
+void run_trace_replay(const string& file_name, int threads, const string& metrics_file = "", int interval = 10000) {
+    TraceReader file(file_name);
+    int memory_size;
+    if (!file || !file.next(memory_size)) {
+        cerr << "Error: Unable to open file " << file_name << "\n";
+        return;
+    }
+
+    vector<unique_ptr<AllocatorBase>> allocators = Policies::make_allocators(memory_size);
+    ofstream metrics;
+    if (!metrics_file.empty()) {
+        metrics.open(metrics_file);
+        if (!metrics) {
+            cerr << "Error: Unable to write " << metrics_file << "\n";
+            return;
+        }
+        write_metrics_header(metrics, memory_size);
+        for (auto& allocator : allocators) allocator->enable_metrics(interval);
+    }
+    vector<Request> chunk;
+    size_t total = 0;
+    auto start = chrono::steady_clock::now();
+    for (bool done = false; !done;) {
+        chunk.clear();
+        while (chunk.size() < (1 << 16)) {
+            int time, size, duration;
+            if (!file.read(time, size, duration) || (time == -1 && size == -1 && duration == -1)) {
+                done = true;
+                break;
             }
+            chunk.push_back({time, size, duration});
         }
+        run_allocators(chunk, allocators, threads);
+        total += chunk.size();
+        if (metrics.is_open()) write_metrics(metrics, allocators);
     }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (!file) cerr << "Error: " << file_name << " has a value that is not a number or out of range\n";
 
-    void print_status(const string& strategy, const StrategyStats& stats) {
-        cout << "\nAfter " << stats.total_requests << " requests (" << strategy << "):\n";
-        cout << "Successful allocations: " << stats.successful_allocations << "\n";
-        cout << "External fragmentation: " << (stats.external_fragmentation * 100.0 / memory_size) << "%\n";
-        cout << "Internal fragmentation: " << (stats.internal_fragmentation * 100.0 / memory_size) << "%\n";
+    for (const auto& allocator : allocators) allocator->print_status(allocator->final_stats());
+    cout << "\nReplayed " << total << " requests in " << seconds << " seconds\n";
+}
+
+// glibc's allocator behind the interface of ArenaAllocator, for the arena benchmark
+struct SystemMalloc {
+    static constexpr const char* name = "glibc malloc";
+
+    void* allocate(size_t size) { return malloc(size); }
+    void deallocate(void* pointer) { free(pointer); }
+    void* reallocate(void* pointer, size_t size) { return realloc(pointer, size); }
+};
+
+// Function to find how many bytes an allocator holds: for glibc what it has taken
+// from the system, for an arena the part of the region up to its last allocated block
+template <typename Allocator>
+size_t footprint(Allocator& allocator) {
+    if constexpr (is_same_v<Allocator, SystemMalloc>) {
+        struct mallinfo2 info = mallinfo2();
+        return info.arena + info.hblkhd;
+    } else {
+        return allocator.usage().extent;
+    }
+}
+
+// What a workload of the arena benchmark reports, measured before it frees what is
+// still live
+struct WorkloadResult {
+    long long operations = 0;
+    long long live_bytes = 0;
+    size_t footprint = 0;
+    bool corrupted = false;
+};
+
+// Tags both ends of a block, so that a block overlapping it is caught when it is freed
+struct TaggedBlock {
+    char* data = nullptr;
+    int size = 0;
+    char tag = 0;
+
+    void write(char new_tag) {
+        tag = new_tag;
+        data[0] = data[size - 1] = tag;
     }
+    bool intact() const { return data[0] == tag && data[size - 1] == tag; }
 };
 
-int main() {
-    MemoryAllocator allocator(1024); // Initialize with 1024 KB memory
-    allocator.process_requests("alloc.dat");
+// Function to replay a trace with real memory: every request allocates its size in
+// bytes and frees it duration ticks later
+template <typename Allocator>
+WorkloadResult replay_trace(Allocator& allocator, const vector<Request>& trace) {
+    using Expiry = pair<int, TaggedBlock>;
+    auto later = [](const Expiry& a, const Expiry& b) { return a.first > b.first; };
+    priority_queue<Expiry, vector<Expiry>, decltype(later)> expirations(later);
+    WorkloadResult result;
+    long long live = 0;
+    auto release = [&] {
+        const TaggedBlock& block = expirations.top().second;
+        result.corrupted |= !block.intact();
+        live -= block.size;
+        allocator.deallocate(block.data);
+        expirations.pop();
+        ++result.operations;
+    };
+
+    char tag = 0;
+    for (const Request& request : trace) {
+        while (!expirations.empty() && expirations.top().first <= request.arrival_time) release();
+        if (request.size <= 0) continue;
+        TaggedBlock block{static_cast<char*>(allocator.allocate(request.size)), request.size};
+        ++result.operations;
+        if (!block.data) continue;
+        block.write(++tag);
+        live += block.size;
+        expirations.push({request.arrival_time + request.duration, block});
+    }
+    result.live_bytes = live;
+    result.footprint = footprint(allocator);
+    while (!expirations.empty()) release();
+    return result;
+}
+
+// Function to run a mixed workload: each of threads threads replaces random entries of
+// a table of live blocks of its own, operations times between them. Sizes are mostly
+// up to 256 bytes, some up to 4 KB and a few up to 64 KB, and one replacement in 16
+// reallocates the block instead.
+template <typename Allocator>
+WorkloadResult run_mixed(Allocator& allocator, int threads, int operations) {
+    atomic<long long> live_bytes{0};
+    atomic<bool> corrupted{false};
+    vector<vector<TaggedBlock>> tables(threads, vector<TaggedBlock>(4096));
+    auto worker = [&](int number) {
+        mt19937 random(number);
+        vector<TaggedBlock>& table = tables[number];
+        long long live = 0;
+        for (int i = number; i < operations; i += threads) {
+            TaggedBlock& block = table[random() % table.size()];
+            int percent = random() % 100;
+            int size = percent < 90 ? 16 + random() % 241 : percent < 99 ? 257 + random() % 3840 : 4097 + random() % 61440;
+            if (block.data && !block.intact()) corrupted = true;
+            if (block.data && random() % 16 == 0) {
+                char* moved = static_cast<char*>(allocator.reallocate(block.data, size));
+                if (!moved) continue;
+                if (moved[0] != block.tag) corrupted = true;
+                live += size - block.size;
+                block.data = moved;
+                block.size = size;
+            } else {
+                if (block.data) {
+                    allocator.deallocate(block.data);
+                    live -= block.size;
+                }
+                block = {static_cast<char*>(allocator.allocate(size)), size};
+                if (!block.data) continue;
+                live += size;
+            }
+            block.write(static_cast<char>(i));
+        }
+        live_bytes += live;
+    };
+    vector<thread> workers;
+    for (int i = 1; i < threads; ++i) workers.emplace_back(worker, i);
+    worker(0);
+    for (auto& t : workers) t.join();
+
+    WorkloadResult result{operations, live_bytes, footprint(allocator), corrupted};
+    for (auto& table : tables) {
+        for (TaggedBlock& block : table) allocator.deallocate(block.data);
+    }
+    return result;
+}
+
+// Function to read this process's resident set size in KB
+long resident_kb() {
+    long pages = 0, resident = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm) {
+        if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) resident = 0;
+        fclose(statm);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Function to run one workload with one allocator in a child process, so that the peak
+// resident size is the workload's own and glibc starts from a heap of its own, and
+// print its row
+template <typename Allocator>
+void benchmark_allocator(const char* workload, int threads, auto run) {
+    cout.flush();
+    pid_t child = fork();
+    if (child == -1) {
+        perror("fork");
+        return;
+    }
+    if (child == 0) {
+        long start_kb = resident_kb();
+        unique_ptr<Allocator> allocator;
+        if constexpr (is_same_v<Allocator, SystemMalloc>) allocator = make_unique<Allocator>();
+        else allocator = make_unique<Allocator>(size_t{1} << 30);
+        size_t start_footprint = footprint(*allocator);
+
+        auto start = chrono::steady_clock::now();
+        WorkloadResult result = run(*allocator);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+
+        size_t held = result.footprint - start_footprint;
+        cout << left << setw(10) << workload << setw(9) << threads << setw(16) << Allocator::name << setw(12)
+             << static_cast<long long>(result.operations / seconds) << setw(14) << usage.ru_maxrss - start_kb
+             << setw(14) << held / 1024 << setw(10) << result.live_bytes / 1024
+             << (held ? 100.0 * (1 - double(result.live_bytes) / held) : 0.0)
+             << (result.corrupted ? "  CORRUPTED" : "") << endl;
+        _exit(result.corrupted ? 1 : 0);
+    }
+    int status;
+    waitpid(child, &status, 0);
+}
+
+// Function to compare the arena with every policy against glibc malloc: replaying a
+// synthetic trace of count requests, then the mixed workload on 1, 2, 4, ... threads
+// up to max_threads
+void run_arena_benchmark(int count, int max_threads) {
+    vector<Request> trace = synthetic_trace(count);
+    auto each_allocator = [&](const char* workload, int threads, auto run) {
+        benchmark_allocator<SystemMalloc>(workload, threads, run);
+        Policies::for_each([&]<PlacementPolicy Policy> { benchmark_allocator<ArenaAllocator<Policy>>(workload, threads, run); });
+    };
+
+    cout << "workload  threads  allocator       ops/sec     peak RSS KB   footprint KB  live KB   overhead %\n";
+    each_allocator("trace", 1, [&](auto& allocator) { return replay_trace(allocator, trace); });
+    for (int threads = 1;; threads = min(threads * 2, max_threads)) {
+        each_allocator("mixed", threads, [&](auto& allocator) { return run_mixed(allocator, threads, count); });
+        if (threads == max_threads) break;
+    }
+}
+
+// Function to compare, for every policy, how much of a synthetic trace of count
+// requests fits on a heap of heap_size without compaction and with each kind, and
+// what the compaction moved and cost
+void run_compaction_benchmark(int count, int heap_size) {
+    vector<Request> trace = synthetic_trace(count);
+    long long requested = 0;
+    for (const Request& request : trace) requested += request.size;
+    CompactionSettings partial{CompactionSettings::Partial};
+    CompactionSettings full{CompactionSettings::Full};
+    CompactionSettings threshold{CompactionSettings::Full, 0.5};
+    const pair<const char*, CompactionSettings> settings[] = {
+        {"none", {}}, {"partial", partial}, {"full", full}, {"full, >50%", threshold}};
+
+    cout << "policy          compaction  requests %  size %      compactions  blocks moved  units moved cost ms     seconds\n";
+    for (const auto& [label, setting] : settings) {
+        for (auto& allocator : Policies::make_allocators(heap_size)) {
+            allocator->set_compaction(setting);
+            auto start = chrono::steady_clock::now();
+            allocator->simulate(trace);
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            const StrategyStats& stats = allocator->final_stats();
+            cout << left << setw(16) << allocator->name() << setw(12) << label << setw(12)
+                 << 100.0 * stats.successful_allocations / stats.total_requests << setw(12)
+                 << 100.0 * (requested - stats.external_fragmentation) / requested << setw(13) << stats.compactions
+                 << setw(14) << stats.blocks_moved << setw(12) << stats.units_moved << setw(12)
+                 << stats.compaction_cost / 1000 << seconds << "\n";
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int hardware_threads = max(1u, thread::hardware_concurrency());
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        run_index_benchmark();
+        run_replay_benchmark();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--sweep") == 0) {
+        int count = argc > 2 ? atoi(argv[2]) : 1000000;
+        int threads = argc > 3 ? max(1, atoi(argv[3])) : hardware_threads;
+        run_sweep(count, threads);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--arena") == 0) {
+        int count = argc > 2 ? atoi(argv[2]) : 1000000;
+        int threads = argc > 3 ? max(1, atoi(argv[3])) : max(4, hardware_threads);
+        run_arena_benchmark(count, threads);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--compact") == 0) {
+        run_compaction_benchmark(argc > 2 ? atoi(argv[2]) : 200000, argc > 3 ? atoi(argv[3]) : 1 << 20);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--metrics") == 0) {
+        int count = argc > 2 ? atoi(argv[2]) : 1000000;
+        string metrics_file = argc > 3 ? argv[3] : "metrics.csv";
+        int interval = argc > 4 ? max(1, atoi(argv[4])) : max(1, count / 100);
+        run_metrics(count, metrics_file, interval, hardware_threads);
+        return 0;
+    }
+    if (argc > 2 && strcmp(argv[1], "--replay") == 0) {
+        int interval = argc > 4 ? max(1, atoi(argv[4])) : 10000;
+        run_trace_replay(argv[2], hardware_threads, argc > 3 ? argv[3] : "", interval);
+        return 0;
+    }
+
+    // Every policy replays the trace on a heap of its own, of the size the trace gives
+    int memory_size;
+    vector<Request> trace;
+    if (!load_trace("alloc.dat", memory_size, trace)) return 1;
+    vector<unique_ptr<AllocatorBase>> allocators = Policies::make_allocators(memory_size);
+    run_allocators(trace, allocators, hardware_threads, 10);
+
+    // Print status after every 10 requests
+    for (size_t point = 0; point < allocators[0]->status_history().size(); ++point) {
+        for (const auto& allocator : allocators) allocator->print_status(allocator->status_history()[point]);
+    }
     return 0;
 }
@@ -1,100 +1,1419 @@
 #include <iostream>
-#include <fstream>
 #include <vector>
 #include <cmath>
 #include <algorithm>
 #include <map>
+#include <iomanip>
+#include <set>
+#include <queue>
+#include <deque>
+#include <bit>
+#include <random>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <array>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <immintrin.h>
+#include "traceReader.h"
 
 using namespace std;
 
+// One bit per minimum block, set while the block is allocated. The bits are kept in
+// 64-bit words, so a range is tested and a search steps 64 blocks at a time with masks
+// and bit scans. The search has an AVX2 path, chosen at run time, that passes over 256
+// fully occupied blocks with one compare. Bits past the end are kept set, in padding up
+// to a multiple of four words, so searches never need to stop short of a word.
+class OccupancyBitmap {
+private:
+    uint64_t bitCount;
+    vector<uint64_t> words;
+
+    static uint64_t lowMask(uint64_t bits) { return bits >= 64 ? ~uint64_t{0} : (uint64_t{1} << bits) - 1; }
+
+    // Bits at every multiple of count, a power of two up to 64
+    static uint64_t startsMask(uint64_t count) { return ~uint64_t{0} / lowMask(count); }
+
+    void apply(uint64_t start, uint64_t count, bool occupied) {
+        uint64_t end = start + count;
+        for (uint64_t bit = start; bit < end;) {
+            uint64_t word = bit / 64;
+            uint64_t span = min<uint64_t>(end - bit, 64 - bit % 64);
+            uint64_t mask = lowMask(span) << (bit % 64);
+            words[word] = occupied ? words[word] | mask : words[word] & ~mask;
+            bit += span;
+        }
+    }
+
+    int64_t findFreeScalar(uint64_t count) const {
+        if (count >= 64) {
+            uint64_t group = count / 64;
+            for (uint64_t word = 0; word + group <= words.size(); word += group) {
+                uint64_t j = 0;
+                while (j < group && words[word + j] == 0) ++j;
+                if (j == group) return word * 64;
+            }
+            return -1;
+        }
+        for (uint64_t word = 0; word < words.size(); ++word) {
+            if (words[word] == ~uint64_t{0}) continue;
+            uint64_t starts = runStarts(words[word], count);
+            if (starts) return word * 64 + countr_zero(starts);
+        }
+        return -1;
+    }
+
+    __attribute__((target("avx2"))) int64_t findFreeAvx2(uint64_t count) const {
+        const __m256i* vectors = reinterpret_cast<const __m256i*>(words.data());
+        if (count >= 256) {
+            uint64_t group = count / 256;
+            for (uint64_t vector = 0; vector + group <= words.size() / 4; vector += group) {
+                uint64_t j = 0;
+                while (j < group) {
+                    __m256i v = _mm256_loadu_si256(vectors + vector + j);
+                    if (!_mm256_testz_si256(v, v)) break;
+                    ++j;
+                }
+                if (j == group) return vector * 256;
+            }
+            return -1;
+        }
+        // Below 256 blocks a run lies within one vector
+        __m256i target = count >= 64 ? _mm256_setzero_si256() : _mm256_set1_epi64x(-1);
+        for (uint64_t vector = 0; vector < words.size() / 4; ++vector) {
+            __m256i v = _mm256_loadu_si256(vectors + vector);
+            int matches = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(v, target)));
+            if (count < 64) {
+                if (matches == 0xf) continue;   // all 256 blocks occupied
+                for (int j = 0; j < 4; ++j) {
+                    uint64_t starts = runStarts(words[vector * 4 + j], count);
+                    if (starts) return (vector * 4 + j) * 64 + countr_zero(starts);
+                }
+            } else {
+                // matches has a bit per free word; a run is count / 64 aligned free words
+                for (uint64_t group = count / 64, shift = 1; shift < group; shift <<= 1) matches &= matches >> shift;
+                matches &= count == 64 ? 0xf : count == 128 ? 0x5 : 0;
+                if (matches) return (vector * 4 + countr_zero(static_cast<unsigned>(matches))) * 64;
+            }
+        }
+        return -1;
+    }
+
+public:
+    explicit OccupancyBitmap(uint64_t bits) : bitCount(bits), words((bits + 255) / 256 * 4, 0) {
+        apply(bits, words.size() * 64 - bits, true);
+    }
+
+    void set(uint64_t start, uint64_t count) { apply(start, count, true); }
+    void clear(uint64_t start, uint64_t count) { apply(start, count, false); }
+
+    // Function to test that count blocks from start are all free, a word at a time
+    bool isFree(uint64_t start, uint64_t count) const {
+        if (count == 0) return true;
+        if (start + count > bitCount) return false;
+        uint64_t end = start + count;
+        uint64_t first = start / 64, last = (end - 1) / 64;
+        if (first == last) return (words[first] & (lowMask(count) << (start % 64))) == 0;
+        if (words[first] >> (start % 64)) return false;
+        for (uint64_t word = first + 1; word < last; ++word) {
+            if (words[word]) return false;
+        }
+        return (words[last] & lowMask(end - last * 64)) == 0;
+    }
+
+    // Function to find the first run of count free blocks that starts at a multiple of
+    // count, a power of two, as a buddy block would. Returns its start or -1.
+    int64_t findFree(uint64_t count) const {
+        static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+        if (count == 0 || count > bitCount) return -1;
+        return hasAvx2 ? findFreeAvx2(count) : findFreeScalar(count);
+    }
+
+    int64_t findFree(uint64_t count, bool vectorized) const {
+        if (count == 0 || count > bitCount) return -1;
+        return vectorized ? findFreeAvx2(count) : findFreeScalar(count);
+    }
+
+    // The same search a block at a time, for comparison
+    int64_t findFreeBitwise(uint64_t count) const {
+        if (count == 0 || count > bitCount) return -1;
+        for (uint64_t start = 0; start + count <= bitCount; start += count) {
+            uint64_t i = 0;
+            while (i < count && !(words[(start + i) / 64] >> ((start + i) % 64) & 1)) ++i;
+            if (i == count) return start;
+        }
+        return -1;
+    }
+
+    uint64_t occupied() const {
+        uint64_t total = 0;
+        for (uint64_t word : words) total += popcount(word);
+        return total - (words.size() * 64 - bitCount);
+    }
+
+    // Function to find where free runs of count blocks, a power of two up to 64, start
+    // in a word: bit i of the result is set if bits i to i + count - 1 are all clear
+    static uint64_t runStarts(uint64_t word, uint64_t count) {
+        uint64_t free = ~word;
+        for (uint64_t shift = 1; shift < count; shift <<= 1) free &= free >> shift;
+        return free & startsMask(count);
+    }
+
+    uint64_t size() const { return bitCount; }
+    uint64_t wordCount() const { return words.size(); }
+
+    // Word index of the bitmap; past the end every block is occupied
+    uint64_t word(uint64_t index) const { return index < words.size() ? words[index] : ~uint64_t{0}; }
+
+    // Function to find the highest order of free buddy block in a word, or -1
+    static int wordOrder(uint64_t word) {
+        uint64_t starts = ~word;
+        if (!starts) return -1;
+        if (!word) return 6;
+        int order = 0;
+        for (uint64_t count = 1; count < 64; count <<= 1, ++order) {
+            starts &= (starts >> count) & startsMask(2 * count);
+            if (!starts) return order;
+        }
+        return order;
+    }
+
+    // Function to find the highest order of free buddy block made of whole aligned
+    // children, given a bit per fully free child, as an order above childOrder
+    static int groupOrder(uint64_t freeChildren, int childOrder) {
+        int order = childOrder;
+        for (uint64_t count = 1; count < 64; count <<= 1, ++order) {
+            freeChildren &= (freeChildren >> count) & startsMask(2 * count);
+            if (!freeChildren) return order;
+        }
+        return order;
+    }
+
+    // Function to find the first of count aligned children set in freeChildren, or -1
+    static int firstGroup(uint64_t freeChildren, uint64_t count) {
+        for (uint64_t shift = 1; shift < count; shift <<= 1) freeChildren &= freeChildren >> shift;
+        freeChildren &= count >= 64 ? 1 : startsMask(count);
+        return freeChildren ? countr_zero(freeChildren) : -1;
+    }
+};
+
+// An OccupancyBitmap with a summary tree over it, so that finding a free aligned run
+// descends the tree instead of scanning. Every group of 4096 blocks (64 words) has a
+// summary byte holding the highest order of free buddy block inside it, or -1, and
+// every 64 bytes of a level have one above them, up to a single root. With a stale bit
+// each, that is 9 bits per 4096 blocks, 0.22% of the bitmap, and a little more above.
+//
+// An update only marks the summaries above it stale, stopping at one already stale; a
+// search brings a summary up to date from its children when it first reads it.
+class SummaryBitmap {
+private:
+    static constexpr int fanoutBits = 6;           // 64 children a summary, 64 blocks a word
+
+    OccupancyBitmap occupancy;
+    vector<vector<int8_t>> levels;                 // levels[0] per 64 words, then per 64 entries below
+    vector<vector<uint64_t>> stale;                // a bit per entry of each level
+
+    // The order of a free block that fills a whole entry of level; level -1 is the words
+    static int fullOrder(int level) { return fanoutBits * (level + 2); }
+
+    bool isStale(int level, uint64_t index) const { return stale[level][index / 64] >> (index % 64) & 1; }
+
+    // Function to read a summary, recomputing it from its children if it is stale
+    int summary(int level, uint64_t index) {
+        if (!isStale(level, index)) return levels[level][index];
+        stale[level][index / 64] &= ~(uint64_t{1} << (index % 64));
+
+        int best = -1;
+        uint64_t freeChildren = 0;
+        int childOrder = fullOrder(level - 1);
+        if (level == 0) {
+            // Most words are empty or full, and need no search
+            for (uint64_t child = 0; child < 64; ++child) {
+                uint64_t word = occupancy.word(index * 64 + child);
+                if (!word) freeChildren |= uint64_t{1} << child;
+                else if (best < childOrder - 1 && ~word) best = max(best, OccupancyBitmap::wordOrder(word));
+            }
+        } else {
+            // The 64 children's stale bits are one word of the level below
+            for (uint64_t staleChildren = stale[level - 1][index]; staleChildren; staleChildren &= staleChildren - 1) {
+                summary(level - 1, index * 64 + countr_zero(staleChildren));
+            }
+            const vector<int8_t>& children = levels[level - 1];
+            uint64_t end = min<uint64_t>(64, children.size() - index * 64);
+            for (uint64_t child = 0; child < end; ++child) {
+                int order = children[index * 64 + child];
+                best = max(best, order);
+                freeChildren |= uint64_t{order == childOrder} << child;
+            }
+        }
+        if (freeChildren) best = OccupancyBitmap::groupOrder(freeChildren, childOrder);
+        return levels[level][index] = best;
+    }
+
+    void markStale(uint64_t start, uint64_t count) {
+        uint64_t first = start >> fullOrder(0), last = (start + count - 1) >> fullOrder(0);
+        for (int level = 0; level < static_cast<int>(levels.size()); ++level) {
+            bool allStale = true;
+            for (uint64_t index = first; index <= last; ++index) {
+                allStale &= isStale(level, index);
+                stale[level][index / 64] |= uint64_t{1} << (index % 64);
+            }
+            // Everything above a stale summary is stale already
+            if (allStale && first == last) return;
+            first >>= fanoutBits;
+            last >>= fanoutBits;
+        }
+    }
+
+public:
+    explicit SummaryBitmap(uint64_t bits) : occupancy(bits) {
+        uint64_t entries = occupancy.wordCount();
+        do {
+            entries = (entries + 63) / 64;
+            levels.emplace_back(entries, -1);
+            stale.emplace_back((entries + 63) / 64, ~uint64_t{0});
+            if (entries % 64) stale.back().back() = (uint64_t{1} << (entries % 64)) - 1;
+        } while (entries > 1);
+    }
+
+    void set(uint64_t start, uint64_t count) {
+        occupancy.set(start, count);
+        if (count) markStale(start, count);
+    }
+
+    void clear(uint64_t start, uint64_t count) {
+        occupancy.clear(start, count);
+        if (count) markStale(start, count);
+    }
+
+    bool isFree(uint64_t start, uint64_t count) const { return occupancy.isFree(start, count); }
+    uint64_t occupied() const { return occupancy.occupied(); }
+
+    // Function to find the first run of count free blocks that starts at a multiple of
+    // count, a power of two, by descending from the root to the first child with a free
+    // block big enough. Returns its start or -1.
+    int64_t findFree(uint64_t count) {
+        if (count == 0 || count > occupancy.size()) return -1;
+        int order = countr_zero(count);
+        int level = levels.size() - 1;
+        if (summary(level, 0) < order) return -1;
+
+        // The root is up to date, so everything below it is too
+        uint64_t child = 0;
+        for (;; --level) {
+            int childOrder = fullOrder(level - 1);
+            uint64_t freeChildren = 0;
+            if (level == 0) {
+                if (order <= childOrder) {
+                    uint64_t starts;
+                    while (!(starts = OccupancyBitmap::runStarts(occupancy.word(child), count))) ++child;
+                    return child * 64 + countr_zero(starts);
+                }
+                for (uint64_t i = 0; i < 64; ++i) freeChildren |= uint64_t{occupancy.word(child + i) == 0} << i;
+            } else {
+                const vector<int8_t>& children = levels[level - 1];
+                if (order <= childOrder) {
+                    while (children[child] < order) ++child;
+                    child *= 64;
+                    continue;
+                }
+                for (uint64_t i = 0; i < 64 && child + i < children.size(); ++i) {
+                    freeChildren |= uint64_t{children[child + i] == childOrder} << i;
+                }
+            }
+            // The run is made of whole children
+            int first = OccupancyBitmap::firstGroup(freeChildren, uint64_t{1} << (order - childOrder));
+            return (child + first) << childOrder;
+        }
+    }
+
+    // Bytes of the summaries, against the bitmap's
+    uint64_t summaryBytes() const {
+        uint64_t total = 0;
+        for (size_t level = 0; level < levels.size(); ++level) total += levels[level].size() + stale[level].size() * 8;
+        return total;
+    }
+    uint64_t bitmapBytes() const { return occupancy.wordCount() * 8; }
+};
+
+// Binary buddy allocator. Memory is split into blocks of minBlockSize << order. Each
+// order has a free list, ordered by address so the lowest block is taken first, and a
+// bitmap with one bit per pair of buddies that holds (first is free) XOR (second is
+// free). A block's buddy is found by flipping the bit of its order in its index, so
+// freeing a block flips its pair's bit and, if the bit is then clear, the buddy is free
+// too and the two merge into a block of the next order. A SummaryBitmap of the
+// minimum blocks answers questions about ranges of memory.
 class BuddySystem {
 private:
-    vector<bool> memory;
-    int memorySize;
-    int minBlockSize;
-    
+    uint64_t memorySize;
+    uint64_t minBlockSize;
+    uint64_t blockCount;                          // blocks of minBlockSize
+    int maxOrder;
+    vector<set<uint64_t>> freeLists;              // per order: index of each free block, in minimum blocks
+    vector<vector<uint64_t>> pairBits;            // per order: one bit per pair of buddies
+    struct Allocation {
+        int order;
+        uint64_t requiredSize;
+    };
+    unordered_map<uint64_t, Allocation> allocations;   // by index of the block
+    uint64_t requestedUnits = 0;                  // of the blocks now allocated
+    uint64_t allocatedUnits = 0;
+    SummaryBitmap occupancy;
+
+    bool flipPair(int order, uint64_t index) {
+        uint64_t pair = index >> (order + 1);
+        pairBits[order][pair / 64] ^= uint64_t{1} << (pair % 64);
+        return pairBits[order][pair / 64] >> (pair % 64) & 1;
+    }
+
+public:
+    BuddySystem(uint64_t size, uint64_t minBlock)
+        : memorySize(size), minBlockSize(minBlock), blockCount(size / minBlock),
+          maxOrder(blockCount ? bit_width(blockCount) - 1 : 0), freeLists(maxOrder + 1), pairBits(maxOrder + 1),
+          occupancy(blockCount) {
+        for (int order = 0; order <= maxOrder; ++order) {
+            uint64_t pairs = ((blockCount >> order) + 1) / 2;
+            pairBits[order].resize((pairs + 63) / 64);
+        }
+        // Memory that is not a power of two is laid out as the largest aligned blocks
+        // that fit; their buddies past the end count as allocated for good
+        uint64_t index = 0;
+        for (int order = maxOrder; order >= 0; --order) {
+            if (blockCount - index < uint64_t{1} << order) continue;
+            freeLists[order].insert(index);
+            flipPair(order, index);
+            index += uint64_t{1} << order;
+        }
+    }
+
+    // Function to allocate a block for requiredSize units, splitting a larger block
+    // if its order has no free block. Returns the index of the block in minimum
+    // blocks, or -1 if there is none big enough.
+    int64_t allocateBlock(uint64_t requiredSize) {
+        if (requiredSize == 0 || requiredSize > memorySize) return -1;
+        uint64_t blocksNeeded = (requiredSize + minBlockSize - 1) / minBlockSize;
+        int order = bit_width(blocksNeeded - 1);
+        int available = order;
+        while (available <= maxOrder && freeLists[available].empty()) ++available;
+        if (available > maxOrder) return -1;
+
+        uint64_t index = *freeLists[available].begin();
+        freeLists[available].erase(freeLists[available].begin());
+        flipPair(available, index);
+        while (available > order) {
+            --available;
+            uint64_t buddy = index + (uint64_t{1} << available);
+            freeLists[available].insert(buddy);
+            flipPair(available, buddy);
+        }
+        allocations[index] = {order, requiredSize};
+        occupancy.set(index, uint64_t{1} << order);
+        requestedUnits += requiredSize;
+        allocatedUnits += minBlockSize << order;
+        return index;
+    }
+
+    // Function to free a block, merging it with its buddy for as long as that is free
+    void freeBlock(uint64_t index) {
+        auto it = allocations.find(index);
+        if (it == allocations.end()) return;
+        int order = it->second.order;
+        requestedUnits -= it->second.requiredSize;
+        allocations.erase(it);
+        allocatedUnits -= minBlockSize << order;
+        occupancy.clear(index, uint64_t{1} << order);
+
+        for (; order < maxOrder; ++order) {
+            if (flipPair(order, index)) break;
+            // Both buddies free: the pair bit stays clear as both leave this order
+            freeLists[order].erase(index ^ (uint64_t{1} << order));
+            index &= ~(uint64_t{1} << order);
+        }
+        if (order == maxOrder) flipPair(order, index);
+        freeLists[order].insert(index);
+    }
+
+    // Function to allocate memory for a process and report it. Returns the block's
+    // index, or -1.
+    int64_t allocateMemory(uint64_t requiredSize, int time, int duration, int processID) {
+        int64_t start = allocateBlock(requiredSize);
+        if (start < 0) return start;
+        cout << "Process " << processID << " allocated " << (minBlockSize << allocations[start].order)
+             << " units starting at block " << start << " at time " << time << " for " << duration << " units." << endl;
+        return start;
+    }
+
+    bool checkAvailable(uint64_t start, uint64_t blocksNeeded) const { return occupancy.isFree(start, blocksNeeded); }
+
+    // Function to find the lowest block where blocksNeeded could be allocated, or -1
+    int64_t findAvailable(uint64_t blocksNeeded) {
+        return blocksNeeded ? occupancy.findFree(bit_ceil(blocksNeeded)) : -1;
+    }
+
+    // Units lost to rounding requests up to a power of two, over the blocks allocated now
+    uint64_t internalFragmentation() const { return allocatedUnits - requestedUnits; }
+    uint64_t allocated() const { return allocatedUnits; }
+    uint64_t size() const { return memorySize; }
+    uint64_t blockSize() const { return minBlockSize; }
+
+    // Size of the largest block there is when everything is free
+    uint64_t largestBlock() const { return blockCount ? minBlockSize << maxOrder : 0; }
+
+    void printFragmentation() const {
+        cout << "Internal fragmentation: " << internalFragmentation() << " of " << allocatedUnits
+             << " allocated units (" << (allocatedUnits ? 100.0 * internalFragmentation() / allocatedUnits : 0.0)
+             << "%)" << endl;
+    }
+};
+
+// Buddy allocator kept entirely in a bitmap of the minimum blocks: a block is
+// allocated by finding the first free aligned run of its size and marking it, and
+// freed by clearing it, which merges it with any free buddies with no further work.
+// It keeps nothing per allocation, so the size is passed back to freeBlock, as with
+// sized deallocation. Bitmap is a SummaryBitmap, or an OccupancyBitmap to compare
+// against a flat scan.
+template <typename Bitmap>
+class BitmapBuddySystem {
+private:
+    uint64_t memorySize;
+    uint64_t minBlockSize;
+    Bitmap occupancy;
+    uint64_t requestedUnits = 0;
+    uint64_t allocatedUnits = 0;
+
+    uint64_t blocksFor(uint64_t requiredSize) const { return bit_ceil((requiredSize + minBlockSize - 1) / minBlockSize); }
+
+public:
+    BitmapBuddySystem(uint64_t size, uint64_t minBlock)
+        : memorySize(size), minBlockSize(minBlock), occupancy(size / minBlock) {}
+
+    // Function to allocate a block for requiredSize units. Returns its index in
+    // minimum blocks, or -1.
+    int64_t allocateBlock(uint64_t requiredSize) {
+        if (requiredSize == 0 || requiredSize > memorySize) return -1;
+        uint64_t blocks = blocksFor(requiredSize);
+        int64_t index = occupancy.findFree(blocks);
+        if (index < 0) return -1;
+        occupancy.set(index, blocks);
+        requestedUnits += requiredSize;
+        allocatedUnits += blocks * minBlockSize;
+        return index;
+    }
+
+    void freeBlock(uint64_t index, uint64_t requiredSize) {
+        uint64_t blocks = blocksFor(requiredSize);
+        occupancy.clear(index, blocks);
+        requestedUnits -= requiredSize;
+        allocatedUnits -= blocks * minBlockSize;
+    }
+
+    uint64_t internalFragmentation() const { return allocatedUnits - requestedUnits; }
+    uint64_t allocated() const { return allocatedUnits; }
+    const Bitmap& bitmap() const { return occupancy; }
+};
+
+// Slab allocator over a BuddySystem for small objects. A request of up to 512 units is
+// rounded up to a size class, and each class carves buddy blocks, its slabs, into at
+// least 16 objects. A slab keeps its free objects in a list of its own, linked through
+// the objects, and is on its class's partial, full or empty list. Objects come from a
+// partial slab, then from an empty one, and only then from a new block. Empty slabs
+// stay with their class until the buddy system runs out, when all of them go back.
+// Larger requests go to the buddy system as they are. Addresses are in units.
+class SlabAllocator {
+private:
+    static constexpr uint32_t objectsPerSlab = 16;
+    static constexpr uint32_t noObject = UINT32_MAX;
+    enum ListKind { Partial, Full, Empty };
+
+    struct Slab {
+        uint64_t block;                            // the buddy block, in minimum blocks
+        int sizeClass;
+        uint32_t inUse = 0;
+        uint32_t carved = 0;                       // objects ever handed out; the rest are untouched
+        uint32_t freeHead = noObject;
+        vector<uint32_t> next;                     // the link kept in each free object
+        ListKind list = Empty;
+        size_t position = 0;                       // in its list
+    };
+
+    struct SizeClass {
+        uint64_t size;
+        uint64_t slabUnits;
+        uint32_t capacity;
+        array<vector<int>, 3> lists;               // slab numbers by ListKind
+    };
+
+    BuddySystem& buddy;
+    uint64_t blockSize;
+    vector<SizeClass> classes;
+    vector<Slab> slabs;
+    vector<int> unusedSlabs;
+    uint64_t granule;                              // units of the smallest slab; slabs and large objects are whole granules
+    vector<int> slabOfGranule;                     // its slab, or -1
+    uint64_t heldUnits = 0;                        // taken from the buddy system
+    uint64_t slabsReleased = 0;
+
+    void moveTo(int number, ListKind list) {
+        Slab& slab = slabs[number];
+        vector<int>& from = classes[slab.sizeClass].lists[slab.list];
+        slabs[from.back()].position = slab.position;
+        from[slab.position] = from.back();
+        from.pop_back();
+        vector<int>& to = classes[slab.sizeClass].lists[list];
+        slab.list = list;
+        slab.position = to.size();
+        to.push_back(number);
+    }
+
+    // Function to allocate from the buddy system, giving back empty slabs and trying
+    // again if it has no room
+    int64_t allocateBuddy(uint64_t units) {
+        uint64_t before = buddy.allocated();
+        int64_t index = buddy.allocateBlock(units);
+        if (index < 0 && shrink() > 0) {
+            before = buddy.allocated();
+            index = buddy.allocateBlock(units);
+        }
+        heldUnits += buddy.allocated() - before;
+        return index;
+    }
+
+    int newSlab(int sizeClass) {
+        SizeClass& objects = classes[sizeClass];
+        int64_t block = allocateBuddy(objects.slabUnits);
+        if (block < 0) return -1;
+        int number;
+        if (unusedSlabs.empty()) {
+            number = slabs.size();
+            slabs.emplace_back();
+        } else {
+            number = unusedSlabs.back();
+            unusedSlabs.pop_back();
+        }
+        Slab& slab = slabs[number];
+        slab.block = block;
+        slab.sizeClass = sizeClass;
+        slab.inUse = slab.carved = 0;
+        slab.freeHead = noObject;
+        slab.next.resize(objects.capacity);
+        slab.list = Empty;
+        slab.position = objects.lists[Empty].size();
+        objects.lists[Empty].push_back(number);
+        fill_n(slabOfGranule.begin() + block * blockSize / granule, objects.slabUnits / granule, number);
+        return number;
+    }
+
+    void releaseSlab(int number) {
+        Slab& slab = slabs[number];
+        uint64_t units = classes[slab.sizeClass].slabUnits;
+        fill_n(slabOfGranule.begin() + slab.block * blockSize / granule, units / granule, -1);
+        uint64_t before = buddy.allocated();
+        buddy.freeBlock(slab.block);
+        heldUnits -= before - buddy.allocated();
+        ++slabsReleased;
+        unusedSlabs.push_back(number);
+    }
+
 public:
-    BuddySystem(int size, int minBlock) : memorySize(size), minBlockSize(minBlock) {
-        int blocks = memorySize / minBlockSize;
-        memory.resize(blocks, false);
+    explicit SlabAllocator(BuddySystem& buddy)
+        : buddy(buddy), blockSize(buddy.blockSize()) {
+        // Steps of a quarter between powers of two, in multiples of 8 units
+        for (uint64_t size : {8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512}) {
+            uint64_t slabUnits = max(blockSize, bit_ceil(size * objectsPerSlab));
+            classes.push_back({size, slabUnits, static_cast<uint32_t>(slabUnits / size), {}});
+        }
+        granule = classes.front().slabUnits;
+        slabOfGranule.assign(buddy.size() / granule + 1, -1);
     }
 
-    bool allocateMemory(int requiredSize, int time, int duration, int processID) {
-        int blockSize = minBlockSize;
-        while (blockSize < requiredSize) {
-            blockSize *= 2;
+    uint64_t largestObject() const { return classes.back().size; }
+
+    // Function to allocate size units. Returns the address of the object, or -1.
+    int64_t allocate(uint64_t size) {
+        auto it = lower_bound(classes.begin(), classes.end(), size,
+                              [](const SizeClass& objects, uint64_t wanted) { return objects.size < wanted; });
+        if (size == 0 || it == classes.end()) {
+            int64_t index = size ? allocateBuddy(size) : -1;
+            return index < 0 ? -1 : index * static_cast<int64_t>(blockSize);
+        }
+        int sizeClass = it - classes.begin();
+        SizeClass& objects = classes[sizeClass];
+        int number;
+        if (!objects.lists[Partial].empty()) {
+            number = objects.lists[Partial].back();
+        } else if (!objects.lists[Empty].empty()) {
+            number = objects.lists[Empty].back();
+        } else if ((number = newSlab(sizeClass)) < 0) {
+            return -1;
+        }
+
+        Slab& slab = slabs[number];
+        uint32_t object;
+        if (slab.freeHead != noObject) {
+            object = slab.freeHead;
+            slab.freeHead = slab.next[object];
+        } else {
+            object = slab.carved++;
+        }
+        if (++slab.inUse == objects.capacity) {
+            moveTo(number, Full);
+        } else if (slab.list == Empty) {
+            moveTo(number, Partial);
         }
-        
-        int blocksNeeded = blockSize / minBlockSize;
-        for (int i = 0; i <= memory.size() - blocksNeeded; ++i) {
-            if (checkAvailable(i, blocksNeeded)) {
-                allocate(i, blocksNeeded, processID, time, duration);
-                return true;
+        return slab.block * blockSize + object * objects.size;
+    }
+
+    void free(uint64_t address) {
+        int number = slabOfGranule[address / granule];
+        if (number < 0) {
+            uint64_t before = buddy.allocated();
+            buddy.freeBlock(address / blockSize);
+            heldUnits -= before - buddy.allocated();
+            return;
+        }
+        Slab& slab = slabs[number];
+        uint32_t object = (address - slab.block * blockSize) / classes[slab.sizeClass].size;
+        slab.next[object] = slab.freeHead;
+        slab.freeHead = object;
+        if (--slab.inUse == 0) {
+            moveTo(number, Empty);
+        } else if (slab.list == Full) {
+            moveTo(number, Partial);
+        }
+    }
+
+    // Function to give every empty slab back to the buddy system. Returns how many.
+    size_t shrink() {
+        size_t released = 0;
+        for (SizeClass& objects : classes) {
+            for (int number : objects.lists[Empty]) releaseSlab(number);
+            released += objects.lists[Empty].size();
+            objects.lists[Empty].clear();
+        }
+        return released;
+    }
+
+    // Units taken from the buddy system, in slabs and in large objects
+    uint64_t held() const { return heldUnits; }
+    uint64_t released() const { return slabsReleased; }
+};
+
+// Buddy allocator that threads can share. Each order has its own lock over its free
+// list and pair bits, and an operation holds one lock at a time: a split takes a block
+// from one order and then hands its halves to the orders below, a merge takes the
+// buddy out of one order and then goes on to the next. A block between two orders
+// counts as allocated, which keeps the pair bits right, but an allocation that finds
+// nothing while one is in flight cannot trust that, so it looks again.
+//
+// In front of the shared lists each thread has a Handle with a magazine of free blocks
+// for each of the smallest orders. An empty magazine refills half full, from that
+// order's list or by carving a block from a higher order into pieces with no further
+// splitting, and a full one gives half its blocks back.
+class ConcurrentBuddySystem {
+public:
+    static constexpr int magazineOrders = 4;       // blocks of 1 to 8 minimum blocks
+    static constexpr size_t magazineSize = 32;
+    static constexpr int batchBits = 4;            // refill 16 at a time
+
+private:
+    struct alignas(64) OrderList {
+        mutex lock;
+        set<uint64_t> blocks;                      // index of each free block, in minimum blocks
+        vector<uint64_t> pairBits;                 // one bit per pair of buddies
+    };
+
+    uint64_t memorySize;
+    uint64_t minBlockSize;
+    uint64_t blockCount;
+    int maxOrder;
+    unique_ptr<OrderList[]> orders;
+    vector<int8_t> blockOrders;                    // order of each allocated block, by its index
+    atomic<uint64_t> allocatedUnits{0};
+    alignas(64) atomic<uint64_t> movesStarted{0};  // splits and merges
+    atomic<uint64_t> movesFinished{0};
+
+    // Function to flip the pair bit of a block; the caller holds its order's lock
+    bool flipPair(int order, uint64_t index) {
+        vector<uint64_t>& bits = orders[order].pairBits;
+        uint64_t pair = index >> (order + 1);
+        bits[pair / 64] ^= uint64_t{1} << (pair % 64);
+        return bits[pair / 64] >> (pair % 64) & 1;
+    }
+
+    // Function to put a free block in its order's list, merging it upwards with its
+    // buddy for as long as that is free
+    void release(uint64_t index, int order) {
+        bool moving = false;
+        for (;; ++order) {
+            {
+                lock_guard lock(orders[order].lock);
+                if (order == maxOrder || flipPair(order, index)) {
+                    if (order == maxOrder) flipPair(order, index);
+                    orders[order].blocks.insert(index);
+                    break;
+                }
+                // Both buddies free: the pair bit stays clear as both leave this order
+                orders[order].blocks.erase(index ^ (uint64_t{1} << order));
+                if (!moving) movesStarted.fetch_add(1);
+                moving = true;
             }
+            index &= ~(uint64_t{1} << order);
         }
-        return false;
+        if (moving) movesFinished.fetch_add(1);
     }
 
-    bool checkAvailable(int start, int blocksNeeded) {
-        for (int i = start; i < start + blocksNeeded; ++i) {
-            if (memory[i] == true) {
-                return false;
+    // Function to take a free block of order, splitting a larger one if its order has
+    // none. Returns its index or -1.
+    int64_t take(int order) {
+        for (;;) {
+            uint64_t finished = movesFinished.load();
+            for (int available = order; available <= maxOrder; ++available) {
+                uint64_t index;
+                {
+                    lock_guard lock(orders[available].lock);
+                    set<uint64_t>& blocks = orders[available].blocks;
+                    if (blocks.empty()) continue;
+                    index = *blocks.begin();
+                    blocks.erase(blocks.begin());
+                    flipPair(available, index);
+                    if (available > order) movesStarted.fetch_add(1);
+                }
+                if (available == order) return index;
+                while (available > order) {
+                    --available;
+                    uint64_t buddy = index + (uint64_t{1} << available);
+                    lock_guard lock(orders[available].lock);
+                    orders[available].blocks.insert(buddy);
+                    flipPair(available, buddy);
+                }
+                movesFinished.fetch_add(1);
+                return index;
             }
+            // Nothing free unless a block was between orders while the lists were read
+            if (movesStarted.load() == finished) return -1;
+            this_thread::yield();
+        }
+    }
+
+    // Function to hand out a block of order that take or a refill got
+    void handOut(uint64_t index, int order) {
+        blockOrders[index] = order;
+        allocatedUnits.fetch_add(minBlockSize << order, memory_order_relaxed);
+    }
+
+    int orderFor(uint64_t requiredSize) const {
+        if (requiredSize == 0 || requiredSize > memorySize) return -1;
+        int order = bit_width((requiredSize + minBlockSize - 1) / minBlockSize - 1);
+        return order <= maxOrder ? order : -1;
+    }
+
+public:
+    ConcurrentBuddySystem(uint64_t size, uint64_t minBlock)
+        : memorySize(size), minBlockSize(minBlock), blockCount(size / minBlock),
+          maxOrder(blockCount ? bit_width(blockCount) - 1 : 0), orders(make_unique<OrderList[]>(maxOrder + 1)),
+          blockOrders(blockCount) {
+        for (int order = 0; order <= maxOrder; ++order) {
+            uint64_t pairs = ((blockCount >> order) + 1) / 2;
+            orders[order].pairBits.resize((pairs + 63) / 64);
+        }
+        uint64_t index = 0;
+        for (int order = maxOrder; order >= 0; --order) {
+            if (blockCount - index < uint64_t{1} << order) continue;
+            orders[order].blocks.insert(index);
+            flipPair(order, index);
+            index += uint64_t{1} << order;
+        }
+    }
+
+    // Function to allocate a block for requiredSize units from the shared lists.
+    // Returns its index in minimum blocks, or -1.
+    int64_t allocateBlock(uint64_t requiredSize) {
+        int order = orderFor(requiredSize);
+        int64_t index = order < 0 ? -1 : take(order);
+        if (index >= 0) handOut(index, order);
+        return index;
+    }
+
+    void freeBlock(uint64_t index) {
+        int order = blockOrders[index];
+        allocatedUnits.fetch_sub(minBlockSize << order, memory_order_relaxed);
+        release(index, order);
+    }
+
+    // Units in allocated blocks, those in magazines included
+    uint64_t allocated() const { return allocatedUnits.load(); }
+
+    // Function to count the free blocks of each order; only while no thread allocates
+    vector<size_t> freeCounts() {
+        vector<size_t> counts;
+        for (int order = 0; order <= maxOrder; ++order) counts.push_back(orders[order].blocks.size());
+        return counts;
+    }
+
+    // A thread's way in: allocations and frees of the smallest orders go through its
+    // magazines. Blocks are handed back when it is destroyed.
+    class Handle {
+    private:
+        ConcurrentBuddySystem& buddy;
+        array<vector<uint64_t>, magazineOrders> magazines;
+
+        void refill(int order) {
+            vector<uint64_t>& magazine = magazines[order];
+            size_t want = size_t{1} << batchBits;
+            {
+                lock_guard lock(buddy.orders[order].lock);
+                set<uint64_t>& blocks = buddy.orders[order].blocks;
+                while (magazine.size() < want && !blocks.empty()) {
+                    magazine.push_back(*blocks.begin());
+                    buddy.flipPair(order, *blocks.begin());
+                    blocks.erase(blocks.begin());
+                }
+            }
+            // The pieces of a carved block are all allocated, so their pair bits are
+            // clear already, as they were while the block was whole
+            while (magazine.size() < want) {
+                int bits = bit_width(want - magazine.size()) - 1;
+                int64_t index = order + bits <= buddy.maxOrder ? buddy.take(order + bits) : -1;
+                if (index < 0 && bits > 0) {
+                    bits = 0;
+                    index = buddy.take(order);
+                }
+                if (index < 0) break;
+                for (uint64_t piece = 0; piece < uint64_t{1} << bits; ++piece) {
+                    magazine.push_back(index + (piece << order));
+                }
+            }
+            for (uint64_t index : magazine) buddy.blockOrders[index] = order;
+            buddy.allocatedUnits.fetch_add(magazine.size() * (buddy.minBlockSize << order), memory_order_relaxed);
+            // Hand out the lowest addresses first
+            sort(magazine.begin(), magazine.end(), greater<>());
+        }
+
+        void flush(int order, size_t keep) {
+            vector<uint64_t>& magazine = magazines[order];
+            buddy.allocatedUnits.fetch_sub((magazine.size() - keep) * (buddy.minBlockSize << order), memory_order_relaxed);
+            for (size_t i = keep; i < magazine.size(); ++i) buddy.release(magazine[i], order);
+            magazine.resize(keep);
+        }
+
+    public:
+        explicit Handle(ConcurrentBuddySystem& buddy) : buddy(buddy) {
+            for (vector<uint64_t>& magazine : magazines) magazine.reserve(magazineSize);
+        }
+
+        ~Handle() {
+            for (int order = 0; order < magazineOrders; ++order) flush(order, 0);
+        }
+
+        Handle(const Handle&) = delete;
+        Handle& operator=(const Handle&) = delete;
+
+        int64_t allocateBlock(uint64_t requiredSize) {
+            int order = buddy.orderFor(requiredSize);
+            if (order < 0 || order >= magazineOrders) return buddy.allocateBlock(requiredSize);
+            vector<uint64_t>& magazine = magazines[order];
+            if (magazine.empty()) refill(order);
+            if (magazine.empty()) return -1;
+            uint64_t index = magazine.back();
+            magazine.pop_back();
+            return index;
+        }
+
+        void freeBlock(uint64_t index) {
+            int order = buddy.blockOrders[index];
+            if (order >= magazineOrders) return buddy.freeBlock(index);
+            vector<uint64_t>& magazine = magazines[order];
+            // Keep the blocks handed back last, which are the likeliest in cache
+            if (magazine.size() == magazineSize) {
+                rotate(magazine.begin(), magazine.begin() + magazineSize / 2, magazine.end());
+                flush(order, magazineSize / 2);
+            }
+            magazine.push_back(index);
+        }
+    };
+};
+
+// One request of a buddy trace: a line of buddy.dat
+struct ProcessRequest {
+    int processID;
+    int memoryRequired;
+    int requestTime;
+    int duration;
+};
+
+// Event-driven simulation of a trace on a BuddySystem. Allocated blocks are released
+// through a min-heap keyed by the time they end, in time order, before each arrival.
+// A request that does not fit waits in a first-come first-served queue, which is
+// retried each time blocks are released, so it may start before the next arrival.
+// Waits go in a histogram of powers of two and peak utilization in a timeline of at
+// most timelineSlots intervals that double in length as the trace goes on, so memory
+// stays proportional to the blocks live and the requests waiting.
+class BuddySimulation {
+private:
+    static constexpr size_t timelineSlots = 32;
+
+    BuddySystem& buddy;
+    bool verbose;
+    priority_queue<pair<int64_t, int64_t>, vector<pair<int64_t, int64_t>>, greater<>> releases;   // end time, block
+    deque<ProcessRequest> waiting;
+    int64_t clock = 0;
+
+    uint64_t requests = 0, immediate = 0, waited = 0, rejected = 0;
+    int64_t totalWait = 0, maxWait = 0;
+    vector<uint64_t> waitHistogram = vector<uint64_t>(64);    // by bit width of the wait
+    uint64_t peakUnits = 0;
+    int64_t peakTime = 0;
+    size_t peakWaiting = 0;
+
+    vector<uint64_t> timeline = vector<uint64_t>(timelineSlots);   // peak allocated units per interval
+    int64_t timelineStart = -1;
+    int64_t slotLength = 1;
+    size_t lastSlot = 0;
+    uint64_t lastUnits = 0;                       // allocated since the last change
+
+    // Function to note the allocated units after a change at time
+    void recordUtilization(int64_t time) {
+        uint64_t units = buddy.allocated();
+        if (units > peakUnits) {
+            peakUnits = units;
+            peakTime = time;
+        }
+        if (timelineStart < 0) timelineStart = time;
+        size_t slot;
+        while ((slot = (time - timelineStart) / slotLength) >= timelineSlots) {
+            for (size_t i = 0; i < timelineSlots / 2; ++i) timeline[i] = max(timeline[2 * i], timeline[2 * i + 1]);
+            fill(timeline.begin() + timelineSlots / 2, timeline.end(), 0);
+            slotLength *= 2;
+            lastSlot /= 2;
+        }
+        // The intervals since the last change held what it left, up to time
+        for (size_t i = lastSlot + 1; i < slot; ++i) timeline[i] = max(timeline[i], lastUnits);
+        if (slot > lastSlot && time > timelineStart + static_cast<int64_t>(slot) * slotLength) {
+            timeline[slot] = max(timeline[slot], lastUnits);
+        }
+        timeline[slot] = max(timeline[slot], units);
+        lastSlot = slot;
+        lastUnits = units;
+    }
+
+    bool tryAllocate(const ProcessRequest& request, int64_t time) {
+        int64_t start = verbose ? buddy.allocateMemory(request.memoryRequired, time, request.duration, request.processID)
+                                : buddy.allocateBlock(request.memoryRequired);
+        if (start < 0) return false;
+
+        int64_t wait = time - request.requestTime;
+        if (wait > 0) {
+            ++waited;
+            totalWait += wait;
+            maxWait = max(maxWait, wait);
+            if (verbose) cout << "Process " << request.processID << " waited " << wait << " units." << endl;
+        } else {
+            ++immediate;
+        }
+        ++waitHistogram[bit_width(static_cast<uint64_t>(wait))];
+        releases.push({time + request.duration, start});
+        recordUtilization(time);
+        if (verbose) {
+            cout << "Process " << request.processID << " will use memory until time " << time + request.duration << endl;
         }
         return true;
     }
 
-    void allocate(int start, int blocksNeeded, int processID, int time, int duration) {
-        for (int i = start; i < start + blocksNeeded; ++i) {
-            memory[i] = true;
+    // Function to release every block that ends by time, starting waiting requests as
+    // memory comes back
+    void advanceTo(int64_t time) {
+        while (!releases.empty() && releases.top().first <= time) {
+            int64_t now = releases.top().first;
+            while (!releases.empty() && releases.top().first == now) {
+                buddy.freeBlock(releases.top().second);
+                releases.pop();
+            }
+            clock = now;
+            recordUtilization(now);
+            while (!waiting.empty() && tryAllocate(waiting.front(), now)) waiting.pop_front();
         }
-        cout << "Process " << processID << " allocated " << blocksNeeded * minBlockSize 
-             << " units starting at block " << start << " at time " << time << " for " << duration << " units." << endl;
+        clock = max(clock, time);
     }
 
-    void deallocateMemory(int start, int blocksNeeded) {
-        for (int i = start; i < start + blocksNeeded; ++i) {
-            memory[i] = false;
+public:
+    BuddySimulation(BuddySystem& buddy, bool verbose) : buddy(buddy), verbose(verbose) {}
+
+    // Function to handle an arrival. Requests are expected in time order; one that is
+    // earlier than the last is taken to arrive now.
+    void arrive(ProcessRequest request) {
+        ++requests;
+        if (request.requestTime < clock) request.requestTime = clock;
+        advanceTo(request.requestTime);
+
+        if (request.memoryRequired <= 0 || static_cast<uint64_t>(request.memoryRequired) > buddy.largestBlock()) {
+            ++rejected;
+            if (verbose) cout << "Process " << request.processID << " could not be allocated memory!" << endl;
+            return;
+        }
+        if (waiting.empty() && tryAllocate(request, request.requestTime)) return;
+        waiting.push_back(request);
+        peakWaiting = max(peakWaiting, waiting.size());
+        if (verbose) {
+            cout << "Process " << request.processID << " waits for memory at time " << request.requestTime << endl;
         }
     }
 
-    void mergeBuddies() {
-        for (int i = 0; i < memory.size(); ++i) {
-            if (memory[i] == false) {
+    // Function to run the clock on until every block is released
+    void finish() { advanceTo(INT64_MAX); }
+
+    void report() const {
+        cout << "Requests: " << requests << ", allocated at once: " << immediate << ", after waiting: " << waited
+             << ", never: " << rejected + waiting.size() << endl;
+        if (waited) {
+            cout << "Wait time: mean " << static_cast<double>(totalWait) / waited << ", max " << maxWait
+                 << ", most waiting at once " << peakWaiting << endl;
+            cout << "wait up to   requests" << endl;
+            for (size_t width = 1; width < waitHistogram.size(); ++width) {
+                if (waitHistogram[width]) cout << left << setw(13) << (uint64_t{1} << width) - 1 << waitHistogram[width] << endl;
             }
         }
+        if (timelineStart < 0) return;
+        cout << "Peak utilization: " << peakUnits << " of " << buddy.size() << " units ("
+             << 100.0 * peakUnits / buddy.size() << "%) at time " << peakTime << endl;
+        cout << "time from    peak units   peak %" << endl;
+        for (size_t slot = 0; slot <= lastSlot; ++slot) {
+            cout << left << setw(13) << timelineStart + static_cast<int64_t>(slot) * slotLength << setw(13)
+                 << timeline[slot] << 100.0 * timeline[slot] / buddy.size() << endl;
+        }
     }
 };
 
-void readData(const string &filename, vector<tuple<int, int, int, int>> &processRequests) {
-    ifstream file(filename);
-    int processID, memoryRequired, requestTime, duration;
-    while (file >> processID >> memoryRequired >> requestTime >> duration) {
-        if (processID < 0) break;
-        processRequests.push_back(make_tuple(processID, memoryRequired, requestTime, duration));
+// Function to stream a trace's arrivals through a simulation, one record at a time
+bool simulateTrace(const string& filename, BuddySimulation& simulation) {
+    TraceReader file(filename);
+    if (!file) return false;
+    ProcessRequest request;
+    while (file.read(request.processID, request.memoryRequired, request.requestTime, request.duration)) {
+        if (request.processID < 0) break;
+        simulation.arrive(request);
+    }
+    return true;
+}
+
+// Function to time allocations and frees as memory grows from 512 units to 2^32.
+// Each size keeps a table of live blocks about half full and replaces random entries,
+// so the cost per operation should stay flat: a split or merge per order at most.
+void runBenchmark() {
+    cout << "memory        ns/allocate  ns/free      internal frag %\n";
+    for (int bits = 9; bits <= 32; bits += bits < 12 ? 3 : 4) {
+        uint64_t memory = uint64_t{1} << bits;
+        BuddySystem buddy(memory, 8);
+        uint64_t maxRequest = min<uint64_t>(memory / 16, 4096);
+        size_t slots = max<uint64_t>(1, min<uint64_t>(1 << 16, memory / maxRequest));
+        vector<int64_t> live(slots, -1);
+        mt19937_64 random(bits);
+
+        const int operations = 2000000;
+        double allocateNs = 0, freeNs = 0;
+        uint64_t fragmentation = 0, allocatedUnits = 0;
+        for (int i = 0; i < operations; ++i) {
+            int64_t& index = live[random() % slots];
+            if (index >= 0) {
+                auto start = chrono::steady_clock::now();
+                buddy.freeBlock(index);
+                freeNs += chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+            }
+            uint64_t size = 1 + random() % maxRequest;
+            auto start = chrono::steady_clock::now();
+            index = buddy.allocateBlock(size);
+            allocateNs += chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+            if (i % 1024 == 0) {
+                fragmentation += buddy.internalFragmentation();
+                allocatedUnits += buddy.allocated();
+            }
+        }
+        cout << left << setw(14) << "2^" + to_string(bits) << setw(13) << allocateNs / operations << setw(13)
+             << freeNs / operations << 100.0 * fragmentation / allocatedUnits << "\n";
+    }
+}
+
+// Function to time OccupancyBitmap::findFree a block at a time, a word at a time and
+// with AVX2, on 2^24 blocks occupied at random with rising density, for runs of
+// several lengths. Blocks per ns is how far the search got in that time.
+void runBitmapBenchmark() {
+    const uint64_t blocks = uint64_t{1} << 24;
+    bool avx2 = __builtin_cpu_supports("avx2");
+    cout << "density   run    found at    bitwise blocks/ns  words blocks/ns  avx2 blocks/ns\n";
+    for (double density : {0.5, 0.9, 0.99, 0.999, 1.0}) {
+        OccupancyBitmap bitmap(blocks);
+        mt19937_64 random(density * 1000);
+        // Occupy whole words at high density, so that runs stay findable a long way in
+        uint64_t granularity = density >= 0.99 ? 64 : 1;
+        for (uint64_t start = 0; start < blocks; start += granularity) {
+            if (random() < density * double(UINT64_MAX)) bitmap.set(start, granularity);
+        }
+        for (uint64_t run : {1, 8, 64, 512}) {
+            int64_t found = bitmap.findFree(run, false);
+            double scanned = found < 0 ? blocks : found + run;
+            auto measure = [&](auto search) {
+                int repeats = 0;
+                auto start = chrono::steady_clock::now();
+                double ns;
+                do {
+                    if (search() != found) return string("mismatch");
+                    ++repeats;
+                    ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+                } while (ns < 2e7);
+                return to_string(scanned * repeats / ns);
+            };
+            cout << left << setw(10) << density << setw(7) << run << setw(12) << found << setw(19)
+                 << measure([&] { return bitmap.findFreeBitwise(run); }) << setw(17)
+                 << measure([&] { return bitmap.findFree(run, false); })
+                 << (avx2 ? measure([&] { return bitmap.findFree(run, true); }) : "-") << "\n";
+        }
+    }
+}
+
+// Function to time allocators over 64 GiB of 4 KiB pages (2^24 blocks) with a table
+// of 2^16 live blocks of up to 1 MiB, replaced at random, for requestCount requests.
+// The flat bitmap scans from the start on every allocation, so it gets a hundredth of
+// the requests.
+void runScaleBenchmark(uint64_t requestCount) {
+    const uint64_t memory = uint64_t{1} << 36, page = 4096, maxRequest = 1 << 20;
+    const size_t slots = 1 << 16;
+    cout << "allocator                  requests     ns/request  failed    memory used %  metadata bytes\n";
+
+    auto run = [&](const char* name, uint64_t requests, auto& allocator, auto allocate, auto release, string metadata) {
+        vector<pair<int64_t, uint64_t>> live(slots, {-1, 0});
+        mt19937_64 random(1);
+        uint64_t failed = 0;
+        auto start = chrono::steady_clock::now();
+        for (uint64_t i = 0; i < requests; ++i) {
+            auto& [index, size] = live[random() % slots];
+            if (index >= 0) release(index, size);
+            size = 1 + random() % maxRequest;
+            index = allocate(size);
+            failed += index < 0;
+        }
+        double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+        cout << left << setw(27) << name << setw(13) << requests << setw(12) << ns / requests << setw(10) << failed
+             << setw(15) << 100.0 * allocator.allocated() / memory << metadata << "\n";
+    };
+
+    {
+        BitmapBuddySystem<SummaryBitmap> buddy(memory, page);
+        run("bitmap + summary", requestCount, buddy, [&](uint64_t size) { return buddy.allocateBlock(size); },
+            [&](uint64_t index, uint64_t size) { buddy.freeBlock(index, size); },
+            to_string(buddy.bitmap().bitmapBytes() + buddy.bitmap().summaryBytes()));
+        cout << "  summary overhead: " << buddy.bitmap().summaryBytes() << " bytes over a "
+             << buddy.bitmap().bitmapBytes() << " byte bitmap ("
+             << 100.0 * buddy.bitmap().summaryBytes() / buddy.bitmap().bitmapBytes() << "%)\n";
+    }
+    {
+        BitmapBuddySystem<OccupancyBitmap> buddy(memory, page);
+        run("bitmap, flat scan", max<uint64_t>(1, requestCount / 100), buddy,
+            [&](uint64_t size) { return buddy.allocateBlock(size); },
+            [&](uint64_t index, uint64_t size) { buddy.freeBlock(index, size); }, to_string(buddy.bitmap().wordCount() * 8));
+    }
+    {
+        BuddySystem buddy(memory, page);
+        run("free lists + summary", requestCount, buddy, [&](uint64_t size) { return buddy.allocateBlock(size); },
+            [&](uint64_t index, uint64_t) { buddy.freeBlock(index); }, "per block");
     }
 }
 
-int main() {
-    string filename = "buddy.dat";
-    vector<tuple<int, int, int, int>> processRequests;
-    
-    readData(filename, processRequests);
+// Function to run threadCount threads sharing operations allocations and frees on
+// one allocator; makeThread gives each thread its way in. Each thread replaces random
+// entries of its own table of live blocks, mostly of 1 to 8 pages. One operation in 8
+// is timed. Every thread runs at least one operation. Returns operations per second
+// and the 50th, 99th and 99.9th percentile ns.
+template <typename MakeThread>
+array<double, 4> runThreads(int threadCount, uint64_t operations, MakeThread makeThread) {
+    const uint64_t page = 4096;
+    operations = max<uint64_t>(operations, threadCount);
+    atomic<int> ready{0};
+    atomic<bool> go{false};
+    vector<vector<float>> latencies(threadCount);
+    vector<thread> threads;
+    for (int t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&, t] {
+            auto&& allocator = makeThread();
+            vector<int64_t> live(64, -1);
+            mt19937_64 random(t);
+            vector<float>& samples = latencies[t];
+            samples.reserve(operations / threadCount / 8 + 1);
+            ++ready;
+            while (!go) this_thread::yield();
+            for (uint64_t i = 0; i < operations / threadCount; ++i) {
+                int64_t& index = live[random() % live.size()];
+                uint64_t size = random() % 10 ? 1 + random() % (8 * page) : 1 + random() % (64 * page);
+                auto start = i % 8 ? chrono::steady_clock::time_point() : chrono::steady_clock::now();
+                if (index >= 0) allocator.freeBlock(index);
+                index = allocator.allocateBlock(size);
+                if (i % 8 == 0) samples.push_back(chrono::duration<float, nano>(chrono::steady_clock::now() - start).count());
+            }
+            for (int64_t index : live) {
+                if (index >= 0) allocator.freeBlock(index);
+            }
+        });
+    }
+    while (ready < threadCount) this_thread::yield();
+    auto start = chrono::steady_clock::now();
+    go = true;
+    for (thread& worker : threads) worker.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    vector<float> all;
+    for (const vector<float>& samples : latencies) all.insert(all.end(), samples.begin(), samples.end());
+    auto percentile = [&](double fraction) {
+        if (all.empty()) return 0.0;
+        auto it = all.begin() + min<size_t>(all.size() - 1, all.size() * fraction);
+        nth_element(all.begin(), it, all.end());
+        return double(*it);
+    };
+    return {operations / threadCount * threadCount / seconds, percentile(0.5), percentile(0.99), percentile(0.999)};
+}
 
-    BuddySystem buddy(512, 8);
+// Function to compare BuddySystem behind one mutex with ConcurrentBuddySystem, with
+// and without magazines, at 1 to 64 threads on 1 GiB of 4 KiB pages
+void runThreadBenchmark(uint64_t operations) {
+    const uint64_t memory = uint64_t{1} << 30, page = 4096;
+    cout << "threads  allocator         ops/sec      p50 ns    p99 ns    p99.9 ns\n";
+    for (int threadCount : {1, 2, 4, 8, 16, 32, 64}) {
+        auto report = [&](const char* name, array<double, 4> result, uint64_t leftOver) {
+            // Whole numbers with a space after each, so that long tails cannot run together
+            cout << left << setw(9) << threadCount << setw(18) << name << setw(12) << uint64_t(result[0]) << ' '
+                 << setw(9) << uint64_t(result[1]) << ' ' << setw(9) << uint64_t(result[2]) << ' ' << uint64_t(result[3]);
+            if (leftOver) cout << "   (" << leftOver << " units still allocated)";
+            cout << "\n";
+        };
+        {
+            BuddySystem buddy(memory, page);
+            mutex lock;
+            struct Locked {
+                BuddySystem& buddy;
+                mutex& lock;
+                int64_t allocateBlock(uint64_t size) {
+                    lock_guard guard(lock);
+                    return buddy.allocateBlock(size);
+                }
+                void freeBlock(uint64_t index) {
+                    lock_guard guard(lock);
+                    buddy.freeBlock(index);
+                }
+            };
+            auto result = runThreads(threadCount, operations, [&] { return Locked{buddy, lock}; });
+            report("global mutex", result, buddy.allocated());
+        }
+        {
+            ConcurrentBuddySystem buddy(memory, page);
+            auto result = runThreads(threadCount, operations, [&]() -> ConcurrentBuddySystem& { return buddy; });
+            report("per-order locks", result, buddy.allocated());
+        }
+        {
+            ConcurrentBuddySystem buddy(memory, page);
+            auto result = runThreads(threadCount, operations, [&] { return ConcurrentBuddySystem::Handle(buddy); });
+            report("magazines", result, buddy.allocated());
+        }
+    }
+}
 
-    for (auto &req : processRequests) {
-        int processID, memoryRequired, requestTime, duration;
-        tie(processID, memoryRequired, requestTime, duration) = req;
+// Function to compare SlabAllocator with BuddySystem's own rounding on small objects.
+// A table of 2^18 live objects is replaced at random for operations operations, nine
+// in ten of a few fixed sizes and the rest of 1 to 512 units. Then memory pressure:
+// fill 1 MiB with 24-unit objects, free them all and fill it with 200-unit ones,
+// which needs the empty slabs of the first class given back.
+void runSlabBenchmark(uint64_t operations) {
+    const uint64_t memory = uint64_t{1} << 28, minBlock = 16;
+    const uint64_t fixedSizes[] = {24, 40, 56, 72, 100, 136, 200, 300};
+    cout << "path          ns/op     live requested  held units    internal frag %\n";
 
-        if (!buddy.allocateMemory(memoryRequired, requestTime, duration, processID)) {
-            cout << "Process " << processID << " could not be allocated memory!" << endl;
+    auto run = [&](const char* name, auto& allocator, auto allocate, auto release) {
+        vector<pair<int64_t, uint64_t>> live(1 << 18, {-1, 0});
+        mt19937_64 random(1);
+        uint64_t requested = 0;
+        auto start = chrono::steady_clock::now();
+        for (uint64_t i = 0; i < operations; ++i) {
+            auto& [address, size] = live[random() % live.size()];
+            if (address >= 0) {
+                release(address);
+                requested -= size;
+            }
+            size = random() % 10 ? fixedSizes[random() % std::size(fixedSizes)] : 1 + random() % 512;
+            address = allocate(size);
+            if (address >= 0) requested += size;
         }
+        double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+        uint64_t held = allocator.held();
+        cout << left << setw(14) << name << setw(10) << ns / operations << setw(16) << requested << setw(14) << held
+             << 100.0 * (held - requested) / held << "\n";
+    };
 
-        cout << "Process " << processID << " will use memory until time " << requestTime + duration << endl;
+    {
+        BuddySystem buddy(memory, minBlock);
+        struct Raw {
+            BuddySystem& buddy;
+            uint64_t held() const { return buddy.allocated(); }
+        } raw{buddy};
+        run("buddy", raw, [&](uint64_t size) { return buddy.allocateBlock(size); },
+            [&](int64_t index) { buddy.freeBlock(index); });
+    }
+    {
+        BuddySystem buddy(memory, minBlock);
+        SlabAllocator slabs(buddy);
+        run("slab", slabs, [&](uint64_t size) { return slabs.allocate(size); }, [&](int64_t address) { slabs.free(address); });
+    }
+
+    cout << "\nmemory pressure on " << (1 << 20) << " units\n";
+    BuddySystem buddy(1 << 20, minBlock);
+    SlabAllocator slabs(buddy);
+    vector<int64_t> objects;
+    for (uint64_t size : {24, 200}) {
+        int64_t address;
+        while ((address = slabs.allocate(size)) >= 0) objects.push_back(address);
+        cout << size << "-unit objects: " << objects.size() << " (" << 100.0 * objects.size() * size / buddy.size()
+             << "% of memory), empty slabs given back so far: " << slabs.released() << "\n";
+        for (int64_t object : objects) slabs.free(object);
+        objects.clear();
+    }
+}
 
-        buddy.deallocateMemory(requestTime, memoryRequired / 8);
+int main(int argc, char *argv[]) {
+    if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+        runBenchmark();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--bitmap-bench") == 0) {
+        runBitmapBenchmark();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--thread-bench") == 0) {
+        runThreadBenchmark(argc > 2 ? strtoull(argv[2], nullptr, 10) : 4000000);
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--slab-bench") == 0) {
+        runSlabBenchmark(argc > 2 ? strtoull(argv[2], nullptr, 10) : 10000000);
+        return 0;
     }
+    if (argc > 1 && strcmp(argv[1], "--scale-bench") == 0) {
+        runScaleBenchmark(argc > 2 ? strtoull(argv[2], nullptr, 10) : 100000000);
+        return 0;
+    }
+
+    // --replay <trace> [memory] [min block]: only the summary, for long traces
+    bool replay = argc > 2 && strcmp(argv[1], "--replay") == 0;
+    string filename = replay ? argv[2] : "buddy.dat";
+    uint64_t memory = replay && argc > 3 ? strtoull(argv[3], nullptr, 10) : 512;
+    uint64_t minBlock = replay && argc > 4 ? max<uint64_t>(1, strtoull(argv[4], nullptr, 10)) : 8;
 
+    BuddySystem buddy(memory, minBlock);
+    BuddySimulation simulation(buddy, !replay);
+    if (!simulateTrace(filename, simulation)) {
+        cerr << "Error: cannot read " << filename << endl;
+        return 1;
+    }
+    // As the last request arrives, then once every block has been released
+    buddy.printFragmentation();
+    simulation.finish();
+    simulation.report();
     return 0;
-}
\ No newline at end of file
+}
@@ -1,5 +1,5 @@
 #include <iostream>
-#include <fstream>
+#include "traceReader.h"
 #include <vector>
 #include <cmath>
 #include <algorithm>
@@ -9,25 +9,18 @@ using namespace std;
 
 void readDiskParameters(const string &filename, int &numCylinders, int &numSectors, int &bytesPerSector,
                     	int &rpm, double &avgSeekTime, int &initialHeadPosition, vector<int> &requests) {
-	ifstream infile(filename);
+	TraceReader infile(filename);
 	if (!infile) {
     	cerr << "Error opening file." << endl;
     	exit(1);
 	}
 
-	infile >> numCylinders;
-	infile >> numSectors;
-	infile >> bytesPerSector;
-	infile >> rpm;
-	infile >> avgSeekTime;
-	infile >> initialHeadPosition;
+	infile.read(numCylinders, numSectors, bytesPerSector, rpm, avgSeekTime, initialHeadPosition);
 
 	int request;
-	while (infile >> request) {
+	while (infile.next(request)) {
     	requests.push_back(request);
 	}
-
-	infile.close();
 }
 
 double calculateAverageRotationalDelay(int numSectors, int rpm) {
@@ -0,0 +1,449 @@
+// run like this -> ./fsBenchmark ./directory_tree ./directorySearch -n 1000000 -o report.json
+// one shape     -> ./fsBenchmark ./directory_tree ./directorySearch -t deep -t longnames
+// one tool      -> ./fsBenchmark - ./directorySearch -n 100000
+// regressions   -> ./fsBenchmark compare base.json report.json 10
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include <map>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <spawn.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+
+namespace fs = std::filesystem;
+using namespace std;
+
+extern char** environ;
+
+// Synthetic tree shapes. Every shape is generated from the seed alone, so the same
+// seed gives the same tree on every machine and commit.
+enum class Shape { Wide, Deep, Tiny, LongNames };
+
+const pair<Shape, const char*> shapeNames[] = {
+    {Shape::Wide, "wide"}, {Shape::Deep, "deep"}, {Shape::Tiny, "tiny"}, {Shape::LongNames, "longnames"}};
+
+// Builds a synthetic tree entry by entry, relative to open directory fds
+class TreeGenerator {
+public:
+    TreeGenerator(const fs::path& root, uint64_t seed) : root(root), random(seed) {}
+
+    // Function to create about entryCount entries of the given shape under root.
+    // Returns the number actually created (files and directories, root excluded).
+    size_t generate(Shape shape, size_t entryCount) {
+        fs::create_directories(root);
+        int rootFd = openDirectory(AT_FDCWD, root.c_str());
+        created = 0;
+        switch (shape) {
+        case Shape::Wide:
+            // 10000 files per directory, 100 directories per group
+            fill(rootFd, entryCount, 10000, [this](size_t i) { return "f" + to_string(i); }, false);
+            break;
+        case Shape::Deep:
+            // Chains 64 directories deep, with 9 files at every level
+            while (created < entryCount) {
+                int fd = makeDirectory(rootFd, "chain" + to_string(created));
+                for (int level = 0; level < 64 && created < entryCount; ++level) {
+                    for (int file = 0; file < 9; ++file) makeFile(fd, "f" + to_string(file), 0);
+                    int child = makeDirectory(fd, "level" + to_string(level));
+                    close(fd);
+                    fd = child;
+                }
+                close(fd);
+            }
+            break;
+        case Shape::Tiny:
+            // 100 files of 1 to 64 bytes per directory, 100 directories per group
+            fill(rootFd, entryCount, 100, [this](size_t i) { return "t" + to_string(i); }, true);
+            break;
+        case Shape::LongNames:
+            // 100 files per directory, named with 100 to 255 random characters
+            fill(rootFd, entryCount, 100, [this](size_t) { return randomName(100 + random() % 156); }, false);
+            break;
+        }
+        makeFile(rootFd, "needle", 0);
+        close(rootFd);
+        return created;
+    }
+
+private:
+    fs::path root;
+    mt19937_64 random;
+    size_t created = 0;
+    string contents = string(64, 'x');
+
+    static int openDirectory(int dirFd, const char* name) {
+        int fd = openat(dirFd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd == -1) throw runtime_error(string("Cannot open ") + name + ": " + strerror(errno));
+        return fd;
+    }
+
+    int makeDirectory(int dirFd, const string& name) {
+        if (mkdirat(dirFd, name.c_str(), 0755) == -1 && errno != EEXIST) {
+            throw runtime_error("Cannot create " + name + ": " + strerror(errno));
+        }
+        ++created;
+        return openDirectory(dirFd, name.c_str());
+    }
+
+    void makeFile(int dirFd, const string& name, size_t size) {
+        int fd = openat(dirFd, name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1) throw runtime_error("Cannot create " + name + ": " + strerror(errno));
+        if (size > 0 && write(fd, contents.data(), size) != static_cast<ssize_t>(size)) {
+            close(fd);
+            throw runtime_error("Cannot write " + name + ": " + strerror(errno));
+        }
+        close(fd);
+        ++created;
+    }
+
+    // Function to fill root with groups of 100 directories holding perDirectory files each
+    template <typename Namer>
+    void fill(int rootFd, size_t entryCount, size_t perDirectory, Namer name, bool tinyContents) {
+        for (size_t directory = 0; created < entryCount; ++directory) {
+            if (directory % 100 == 0) {
+                int group = makeDirectory(rootFd, "g" + to_string(directory / 100));
+                close(group);
+            }
+            int groupFd = openDirectory(rootFd, ("g" + to_string(directory / 100)).c_str());
+            int fd = makeDirectory(groupFd, "d" + to_string(directory % 100));
+            close(groupFd);
+            for (size_t file = 0; file < perDirectory && created < entryCount; ++file) {
+                makeFile(fd, name(file), tinyContents ? 1 + random() % 64 : 0);
+            }
+            close(fd);
+        }
+    }
+
+    string randomName(size_t length) {
+        static const char alphabet[] = "abcdefghijklmnopqrstuvwxyz0123456789._-";
+        string name(length, ' ');
+        for (char& c : name) c = alphabet[random() % (sizeof alphabet - 1)];
+        if (name[0] == '.') name[0] = 'n';   // keep the tree free of hidden files
+        return name;
+    }
+};
+
+// What one run of a tool cost
+struct Measurement {
+    double seconds = 0;
+    double firstLineSeconds = 0;   // until the first complete line of output
+    long maxRssKb = 0;
+    size_t syscalls = 0;
+};
+
+// Function to run a program with stdout read back through a pipe, timing the run and
+// the first line of output. posix_spawn does not copy this process, so the child's
+// ru_maxrss is its own.
+Measurement timeRun(const vector<string>& arguments) {
+    vector<char*> argv;
+    for (const auto& argument : arguments) argv.push_back(const_cast<char*>(argument.c_str()));
+    argv.push_back(nullptr);
+
+    int pipeFds[2];
+    if (pipe2(pipeFds, O_CLOEXEC) == -1) throw runtime_error(string("pipe failed: ") + strerror(errno));
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, pipeFds[1], STDOUT_FILENO);
+
+    Measurement measurement;
+    auto start = chrono::steady_clock::now();
+    pid_t pid;
+    int error = posix_spawn(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(pipeFds[1]);
+    if (error != 0) {
+        close(pipeFds[0]);
+        throw runtime_error("Cannot run " + arguments[0] + ": " + strerror(error));
+    }
+
+    vector<char> buffer(1 << 16);
+    bool sawLine = false;
+    for (;;) {
+        ssize_t length = read(pipeFds[0], buffer.data(), buffer.size());
+        if (length == -1 && errno == EINTR) continue;
+        if (length <= 0) break;
+        if (!sawLine && memchr(buffer.data(), '\n', length)) {
+            sawLine = true;
+            measurement.firstLineSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        }
+    }
+    close(pipeFds[0]);
+
+    int status;
+    struct rusage usage;
+    wait4(pid, &status, 0, &usage);
+    measurement.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (!sawLine) measurement.firstLineSeconds = measurement.seconds;
+    measurement.maxRssKb = usage.ru_maxrss;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        throw runtime_error(arguments[0] + " failed with status " + to_string(status));
+    }
+    return measurement;
+}
+
+// Function to count the system calls a program makes, in every thread it starts, by
+// tracing it with ptrace. Tracing slows the run down, so it is done apart from timeRun.
+size_t countSyscalls(const vector<string>& arguments) {
+    vector<char*> argv;
+    for (const auto& argument : arguments) argv.push_back(const_cast<char*>(argument.c_str()));
+    argv.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid == -1) throw runtime_error(string("fork failed: ") + strerror(errno));
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+        raise(SIGSTOP);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    ptrace(PTRACE_SETOPTIONS, pid, nullptr, PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL | PTRACE_O_TRACECLONE);
+    ptrace(PTRACE_SYSCALL, pid, nullptr, 0);
+
+    // Every system call stops its thread twice, on entry and on exit, except the
+    // exit_group of each thread, which never returns.
+    size_t stops = 0;
+    size_t threads = 1;
+    for (;;) {
+        pid_t tid = waitpid(-1, &status, __WALL);
+        if (tid == -1) break;
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            if (tid == pid) break;
+            continue;
+        }
+        int signal = 0;
+        int stop = WSTOPSIG(status);
+        if (stop == (SIGTRAP | 0x80)) {
+            ++stops;
+        } else if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_CLONE << 8))) {
+            ++threads;
+        } else if (stop != SIGTRAP && stop != SIGSTOP) {
+            signal = stop;   // traps from exec and the first stop of new threads are ours
+        }
+        ptrace(PTRACE_SYSCALL, tid, nullptr, signal);
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        throw runtime_error(arguments[0] + " failed under ptrace with status " + to_string(status));
+    }
+    return (stops + threads) / 2;
+}
+
+// One way of running one of the tools. "{dir}" and "{index}" in the arguments stand
+// for the tree and the index file.
+struct Mode {
+    const char* tool;
+    const char* name;
+    vector<string> arguments;
+};
+
+const vector<Mode> modes = {
+    {"tree", "default", {"{dir}"}},
+    {"tree", "-j 4", {"{dir}", "-j", "4"}},
+    {"tree", "compact", {"{dir}", "-c"}},
+    {"tree", "streaming", {"{dir}", "-s"}},
+    {"tree", "du", {"{dir}", "-u", "10"}},
+    {"search", "getdents", {"{dir}", "needle"}},
+    {"search", "iterator", {"{dir}", "needle", "-i"}},
+    {"search", "matches", {"{dir}", "-g", "*7"}},
+    {"search", "index", {"index", "{dir}", "{index}"}},
+    {"search", "query", {"query", "{index}", "needle"}},
+};
+
+// One row of the report
+struct Result {
+    string shape;
+    size_t entries;
+    string tool;
+    string mode;
+    Measurement measurement;
+};
+
+// Function to write the report as JSON, one result object per line
+void writeReport(const fs::path& file, const string& label, uint64_t seed, const vector<Result>& results) {
+    ofstream out(file);
+    if (!out) throw runtime_error("Cannot write " + file.string());
+    out << "{\"label\":" << quoted(label) << ",\"seed\":" << seed
+        << ",\"cpus\":" << sysconf(_SC_NPROCESSORS_ONLN) << ",\"results\":[\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& result = results[i];
+        const Measurement& m = result.measurement;
+        out << "{\"shape\":\"" << result.shape << "\",\"entries\":" << result.entries << ",\"tool\":\""
+            << result.tool << "\",\"mode\":\"" << result.mode << "\",\"seconds\":" << m.seconds
+            << ",\"entries_per_sec\":" << static_cast<size_t>(result.entries / m.seconds)
+            << ",\"first_line_ms\":" << m.firstLineSeconds * 1000 << ",\"max_rss_kb\":" << m.maxRssKb
+            << ",\"syscalls\":" << m.syscalls << "}" << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "]}\n";
+}
+
+// Function to read the results back from a report written by writeReport, keyed by
+// shape, entries, tool and mode, with the seconds of each
+map<string, double> readReport(const fs::path& file) {
+    ifstream in(file);
+    if (!in) throw runtime_error("Cannot read " + file.string());
+    auto field = [](const string& line, const string& key) {
+        size_t start = line.find("\"" + key + "\":");
+        if (start == string::npos) return string();
+        start += key.size() + 3;
+        if (line[start] == '"') return line.substr(start + 1, line.find('"', start + 1) - start - 1);
+        return line.substr(start, line.find_first_of(",}", start) - start);
+    };
+    map<string, double> seconds;
+    string line;
+    while (getline(in, line)) {
+        if (line.rfind("{\"shape\"", 0) != 0) continue;
+        string key = field(line, "shape") + " " + field(line, "entries") + " " + field(line, "tool") + " " +
+                     field(line, "mode");
+        seconds[key] = strtod(field(line, "seconds").c_str(), nullptr);
+    }
+    return seconds;
+}
+
+// Function to compare two reports row by row. Returns false if any run got slower
+// by more than threshold percent.
+bool compareReports(const fs::path& baseFile, const fs::path& newFile, double threshold) {
+    map<string, double> base = readReport(baseFile);
+    map<string, double> current = readReport(newFile);
+    bool passed = true;
+    cout << "run                                        base s     new s    change\n";
+    for (const auto& [key, seconds] : current) {
+        auto it = base.find(key);
+        if (it == base.end()) continue;
+        double change = (seconds / it->second - 1) * 100;
+        bool regression = change > threshold;
+        passed = passed && !regression;
+        ostringstream row;
+        row << key << string(key.size() < 42 ? 42 - key.size() : 1, ' ') << it->second << "\t" << seconds << "\t"
+            << showpos << static_cast<int>(change) << "%" << (regression ? "  REGRESSION" : "");
+        cout << row.str() << "\n";
+    }
+    return passed;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc >= 4 && string(argv[1]) == "compare") {
+        try {
+            double threshold = argc > 4 ? strtod(argv[4], nullptr) : 10;
+            return compareReports(argv[2], argv[3], threshold) ? 0 : 1;
+        } catch (const exception& e) {
+            cerr << "Error: " << e.what() << "\n";
+            return 1;
+        }
+    }
+    if (argc < 3) {
+        cerr << "Usage: " << argv[0] << " <tree_binary|-> <search_binary|-> [-d work_dir] [-n max_entries]"
+             << " [-t shape]... [-r runs] [-s seed] [-o report.json] [-l label]\n"
+             << "       " << argv[0] << " compare <base.json> <new.json> [threshold_percent]\n"
+             << "Shapes: wide, deep, tiny, longnames. Sizes go from 10000 up to max_entries by tens.\n";
+        return 1;
+    }
+
+    map<string, string> binaries;
+    if (string(argv[1]) != "-") binaries["tree"] = fs::absolute(argv[1]).string();
+    if (string(argv[2]) != "-") binaries["search"] = fs::absolute(argv[2]).string();
+    fs::path workDirectory = fs::temp_directory_path();
+    size_t maxEntries = 1000000;
+    vector<Shape> shapes;
+    int runs = 3;
+    uint64_t seed = 1;
+    fs::path reportFile;
+    string label;
+
+    for (int i = 3; i < argc; ++i) {
+        string arg = argv[i];
+        if (i + 1 == argc) break;
+        if (arg == "-d") workDirectory = argv[++i];
+        if (arg == "-n") maxEntries = strtoull(argv[++i], nullptr, 10);
+        if (arg == "-r") runs = max(1, atoi(argv[++i]));
+        if (arg == "-s") seed = strtoull(argv[++i], nullptr, 10);
+        if (arg == "-o") reportFile = argv[++i];
+        if (arg == "-l") label = argv[++i];
+        if (arg == "-t") {
+            string name = argv[++i];
+            auto it = find_if(begin(shapeNames), end(shapeNames), [&](const auto& shape) { return name == shape.second; });
+            if (it == end(shapeNames)) {
+                cerr << "Error: unknown shape " << name << "\n";
+                return 1;
+            }
+            shapes.push_back(it->first);
+        }
+    }
+    if (shapes.empty()) {
+        for (const auto& shape : shapeNames) shapes.push_back(shape.first);
+    }
+
+    fs::path root = workDirectory / ("fs-bench-" + to_string(getpid()));
+    fs::path tree = root / "tree";
+    fs::path index = root / "tree.index";
+    vector<Result> results;
+    try {
+        cout << "shape      entries    tool    mode        seconds     entries/sec first ms    max rss KB  syscalls\n";
+        for (Shape shape : shapes) {
+            const char* shapeName = find_if(begin(shapeNames), end(shapeNames),
+                                            [&](const auto& entry) { return entry.first == shape; })->second;
+            for (size_t target = 10000; target <= maxEntries; target *= 10) {
+                fs::remove_all(root);
+                size_t entries = TreeGenerator(tree, seed).generate(shape, target);
+                for (const Mode& mode : modes) {
+                    auto binary = binaries.find(mode.tool);
+                    if (binary == binaries.end()) continue;
+                    vector<string> arguments = {binary->second};
+                    for (const string& argument : mode.arguments) {
+                        arguments.push_back(argument == "{dir}" ? tree.string() : argument == "{index}" ? index.string() : argument);
+                    }
+
+                    // Best of the timed runs on a warm cache, peak RSS over all of them
+                    Measurement best;
+                    best.seconds = 1e30;
+                    for (int run = 0; run < runs; ++run) {
+                        if (mode.name == string("index")) fs::remove(index);
+                        Measurement measurement = timeRun(arguments);
+                        long maxRssKb = max(best.maxRssKb, measurement.maxRssKb);
+                        if (measurement.seconds < best.seconds) best = measurement;
+                        best.maxRssKb = maxRssKb;
+                    }
+                    // The index is built cold every time, and left for the query runs
+                    if (mode.name == string("index")) fs::remove(index);
+                    best.syscalls = countSyscalls(arguments);
+
+                    results.push_back({shapeName, entries, mode.tool, mode.name, best});
+                    ostringstream row;
+                    row << left << setw(11) << shapeName << setw(11) << entries << setw(8) << mode.tool << setw(12)
+                        << mode.name << setw(12) << best.seconds << setw(12) << static_cast<size_t>(entries / best.seconds)
+                        << setw(12) << best.firstLineSeconds * 1000 << setw(12) << best.maxRssKb << best.syscalls;
+                    cout << row.str() << endl;
+                }
+            }
+        }
+        fs::remove_all(root);
+        if (!reportFile.empty()) {
+            writeReport(reportFile, label, seed, results);
+            cout << "Report written to " << reportFile << "\n";
+        }
+    } catch (const exception& e) {
+        cerr << "Error: " << e.what() << "\n";
+        fs::remove_all(root);
+        return 1;
+    }
+    return 0;
+}
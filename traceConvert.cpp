@@ -0,0 +1,116 @@
+// text to binary -> ./traceConvert alloc.dat alloc.trace
+// binary to text -> ./traceConvert alloc.trace alloc.txt
+// parse speed    -> ./traceConvert bench 100000000
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <string>
+#include <chrono>
+#include <random>
+#include <cstdlib>
+#include "traceReader.h"
+
+namespace fs = std::filesystem;
+using namespace std;
+
+// Function to convert a trace between its text and binary forms; the direction
+// follows the input
+bool convertTrace(const string& input, const string& output) {
+    TraceReader reader(input);
+    if (!reader) {
+        cerr << "Error: cannot read " << input << "\n";
+        return false;
+    }
+    TraceWriter writer(output, !reader.isBinary(), reader.separator());
+    if (!writer) {
+        cerr << "Error: cannot write " << output << "\n";
+        return false;
+    }
+
+    TraceToken token;
+    size_t count = 0;
+    while (reader.nextToken(token)) {
+        writer.write(token);
+        if (token.kind != TraceToken::EndOfLine) ++count;
+    }
+    if (!reader) {
+        cerr << "Error: " << input << " has a value that is not a number after " << count << " values\n";
+        return false;
+    }
+    writer.flush();
+    cout << "Converted " << count << " values to " << (reader.isBinary() ? "text" : "binary") << ": "
+         << fs::file_size(input) << " -> " << fs::file_size(output) << " bytes\n";
+    return true;
+}
+
+// Function to read this process's resident set size in KB
+long residentKb() {
+    ifstream statm("/proc/self/statm");
+    long pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Function to compare parsing an alloc.dat style trace of lineCount lines with
+// ifstream and with TraceReader, on the text and on the binary form
+void runBenchmark(size_t lineCount) {
+    fs::path text = fs::temp_directory_path() / ("trace-bench-" + to_string(getpid()) + ".dat");
+    fs::path binary = text;
+    binary.replace_extension(".trace");
+    {
+        ofstream out(text, ios::binary);
+        mt19937 random(1);
+        string buffer;
+        int time = 0;
+        buffer += "1048576\n";
+        for (size_t i = 0; i < lineCount; ++i) {
+            time += random() % 3;
+            buffer += to_string(time) + ' ' + to_string(1 + random() % 4096) + ' ' + to_string(1 + random() % 1000) + '\n';
+            if (buffer.size() >= (1 << 20)) {
+                out << buffer;
+                buffer.clear();
+            }
+        }
+        out << buffer << "-1 -1 -1\n";
+    }
+    if (!convertTrace(text, binary)) return;
+
+    auto report = [&](const char* name, auto parse) {
+        auto start = chrono::steady_clock::now();
+        auto [sum, resident] = parse();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << name << string(20 - strlen(name), ' ') << seconds << "\t" << static_cast<size_t>(lineCount / seconds)
+             << "\t" << resident << "\t(checksum " << sum << ")\n";
+    };
+
+    cout << "\nparser              seconds     lines/sec   resident KB\n";
+    report("ifstream >>", [&] {
+        ifstream file(text);
+        long long sum = 0, value;
+        while (file >> value) sum += value;
+        return pair(sum, residentKb());
+    });
+    for (const fs::path& path : {text, binary}) {
+        report(path == text ? "TraceReader text" : "TraceReader binary", [&] {
+            TraceReader reader(path.string());
+            long long sum = 0, value;
+            while (reader.next(value)) sum += value;
+            return pair(sum, residentKb());
+        });
+    }
+    fs::remove(text);
+    fs::remove(binary);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc >= 2 && string(argv[1]) == "bench") {
+        runBenchmark(argc > 2 ? strtoull(argv[2], nullptr, 10) : 10000000);
+        return 0;
+    }
+    if (argc != 3) {
+        cerr << "Usage: " << argv[0] << " <input> <output>   (text to binary, or binary to text)\n"
+             << "       " << argv[0] << " bench [line_count]\n";
+        return 1;
+    }
+    return convertTrace(argv[1], argv[2]) ? 0 : 1;
+}
@@ -0,0 +1,308 @@
+// Trace reader shared by the .dat-driven simulators (Variablepartition, buddy,
+// 2processorScheduling, diskScheduling).
+//
+// A trace is a sequence of numbers separated by spaces, tabs or commas, in lines.
+// TraceReader maps the file and parses it in place with std::from_chars, handing back
+// one value at a time, and returns the pages it has parsed to the kernel as it goes,
+// so reading a trace of any length takes constant memory. The same reader also reads
+// the compact binary form written by TraceWriter (see traceConvert.cpp):
+//
+//   "OSTRACE1", then one byte: the text separator (',' or ' ')
+//   then one varint per item; its low two bits are the kind:
+//     0  integer, zigzag-encoded in the remaining bits
+//     1  real number, followed by its 8 bytes as a little-endian double
+//     2  end of line
+//     3  integer too wide for the remaining bits, zigzag-encoded in a second varint
+#ifndef TRACE_READER_H
+#define TRACE_READER_H
+
+#include <string>
+#include <fstream>
+#include <charconv>
+#include <algorithm>
+#include <type_traits>
+#include <limits>
+#include <cstdint>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// One item of a trace: a number or the end of a line
+struct TraceToken {
+    enum Kind { Integer, Real, EndOfLine };
+
+    Kind kind = EndOfLine;
+    int64_t integer = 0;
+    double real = 0;
+};
+
+inline constexpr char traceMagic[8] = {'O', 'S', 'T', 'R', 'A', 'C', 'E', '1'};
+
+class TraceReader {
+public:
+    explicit TraceReader(const std::string& filename) {
+        int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) return;
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) == 0) {
+            size = fileStat.st_size;
+            if (size == 0) {
+                good = true;
+            } else {
+                void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapping != MAP_FAILED) {
+                    data = static_cast<const char*>(mapping);
+                    madvise(mapping, size, MADV_SEQUENTIAL);
+                    good = true;
+                }
+            }
+        }
+        close(fd);
+        if (good && size > sizeof traceMagic && memcmp(data, traceMagic, sizeof traceMagic) == 0) {
+            binary = true;
+            textSeparator = data[sizeof traceMagic];
+            position = sizeof traceMagic + 1;
+        } else if (good && size > 0 && memchr(data, ',', std::min<size_t>(size, 4096))) {
+            textSeparator = ',';
+        }
+    }
+
+    ~TraceReader() {
+        if (data) munmap(const_cast<char*>(data), size);
+    }
+
+    TraceReader(const TraceReader&) = delete;
+    TraceReader& operator=(const TraceReader&) = delete;
+
+    // False if the file could not be opened, or once a value failed to parse
+    explicit operator bool() const { return good; }
+
+    bool isBinary() const { return binary; }
+
+    // The separator of the text form: ',' if the trace has commas between values
+    char separator() const { return textSeparator; }
+
+    // Function to read the next item, line ends included. Returns false at the end of
+    // the trace or on a value that is not a number.
+    bool nextToken(TraceToken& token) {
+        if (!good) return false;
+        if (position - released >= releaseInterval) release();
+        return binary ? nextBinaryToken(token) : nextTextToken(token);
+    }
+
+    // Function to read the next number into value, across line ends. An integer value
+    // only accepts integers it can hold.
+    template <typename T>
+    bool next(T& value) {
+        TraceToken token;
+        do {
+            if (!nextToken(token)) return false;
+        } while (token.kind == TraceToken::EndOfLine);
+        if constexpr (std::is_integral_v<T>) {
+            if (token.kind != TraceToken::Integer || !fits<T>(token.integer)) return good = false;
+            value = static_cast<T>(token.integer);
+        } else {
+            value = token.kind == TraceToken::Integer ? static_cast<T>(token.integer) : static_cast<T>(token.real);
+        }
+        return true;
+    }
+
+    // Function to read a whole record, e.g. reader.read(time, size, duration)
+    template <typename... T>
+    bool read(T&... values) {
+        return (next(values) && ...);
+    }
+
+private:
+    // Parsed pages are dropped this many bytes at a time
+    static constexpr size_t releaseInterval = 8 << 20;
+
+    const char* data = nullptr;
+    size_t size = 0;
+    size_t position = 0;
+    size_t released = 0;   // everything before this has been given back
+    bool good = false;
+    bool binary = false;
+    char textSeparator = ' ';
+
+    template <typename T>
+    static bool fits(int64_t integer) {
+        using Limits = std::numeric_limits<T>;
+        if constexpr (std::is_signed_v<T>) {
+            return integer >= static_cast<int64_t>(Limits::min()) && integer <= static_cast<int64_t>(Limits::max());
+        } else {
+            return integer >= 0 && static_cast<uint64_t>(integer) <= Limits::max();
+        }
+    }
+
+    static bool isSeparator(char c) { return c == ' ' || c == ',' || c == '\t' || c == '\r' || c == '\n'; }
+
+    void release() {
+        size_t pageSize = sysconf(_SC_PAGESIZE);
+        size_t end = position / pageSize * pageSize;
+        if (end > released) madvise(const_cast<char*>(data) + released, end - released, MADV_DONTNEED);
+        released = end;
+    }
+
+    bool nextTextToken(TraceToken& token) {
+        while (position < size && isSeparator(data[position])) {
+            if (data[position++] == '\n') {
+                token.kind = TraceToken::EndOfLine;
+                return true;
+            }
+        }
+        if (position == size) return false;
+
+        const char* begin = data + position;
+        const char* end = data + size;
+        auto [integerEnd, integerError] = std::from_chars(begin, end, token.integer);
+        if (integerError == std::errc() && (integerEnd == end || isSeparator(*integerEnd))) {
+            token.kind = TraceToken::Integer;
+            position = integerEnd - data;
+            return true;
+        }
+        auto [realEnd, realError] = std::from_chars(begin, end, token.real);
+        if (realError == std::errc() && (realEnd == end || isSeparator(*realEnd))) {
+            token.kind = TraceToken::Real;
+            position = realEnd - data;
+            return true;
+        }
+        return good = false;
+    }
+
+    bool readVarint(uint64_t& value) {
+        value = 0;
+        for (int shift = 0;; shift += 7) {
+            if (position == size || shift > 63) return false;
+            uint8_t byte = data[position++];
+            if (shift == 63 && (byte & 0x7f) > 1) return false;
+            value |= uint64_t(byte & 0x7f) << shift;
+            if (byte < 0x80) return true;
+        }
+    }
+
+    static int64_t unzigzag(uint64_t zigzag) { return static_cast<int64_t>(zigzag >> 1) ^ -static_cast<int64_t>(zigzag & 1); }
+
+    bool nextBinaryToken(TraceToken& token) {
+        if (position == size) return false;
+        uint64_t item;
+        if (!readVarint(item)) return good = false;
+        switch (item & 3) {
+        case 0:
+            token.kind = TraceToken::Integer;
+            token.integer = unzigzag(item >> 2);
+            return true;
+        case 1:
+            if (size - position < sizeof token.real) return good = false;
+            memcpy(&token.real, data + position, sizeof token.real);
+            position += sizeof token.real;
+            token.kind = TraceToken::Real;
+            return true;
+        case 2:
+            token.kind = TraceToken::EndOfLine;
+            return true;
+        default: {
+            uint64_t zigzag;
+            if (item != 3 || !readVarint(zigzag)) return good = false;
+            token.kind = TraceToken::Integer;
+            token.integer = unzigzag(zigzag);
+            return true;
+        }
+        }
+    }
+};
+
+// Writes a trace item by item, either as text with the given separator or in the
+// binary form TraceReader reads
+class TraceWriter {
+public:
+    TraceWriter(const std::string& filename, bool binary, char separator)
+        : file(filename, std::ios::binary | std::ios::trunc), binary(binary), separator(separator) {
+        if (binary) {
+            buffer.append(traceMagic, sizeof traceMagic);
+            buffer += separator;
+        }
+    }
+
+    ~TraceWriter() { flush(); }
+
+    explicit operator bool() const { return static_cast<bool>(file); }
+
+    void write(const TraceToken& token) {
+        if (binary) {
+            writeBinary(token);
+        } else {
+            writeText(token);
+        }
+        if (buffer.size() >= (1 << 20)) flush();
+    }
+
+    void flush() {
+        file.write(buffer.data(), buffer.size());
+        file.flush();
+        buffer.clear();
+    }
+
+private:
+    std::ofstream file;
+    bool binary;
+    char separator;
+    bool lineStart = true;
+    std::string buffer;
+
+    void putVarint(uint64_t value) {
+        while (value >= 0x80) {
+            buffer += static_cast<char>(value | 0x80);
+            value >>= 7;
+        }
+        buffer += static_cast<char>(value);
+    }
+
+    void writeBinary(const TraceToken& token) {
+        if (token.kind == TraceToken::Integer) {
+            uint64_t zigzag = (static_cast<uint64_t>(token.integer) << 1) ^ static_cast<uint64_t>(token.integer >> 63);
+            if (zigzag >> 62) {
+                // The tag would push the top bits out
+                putVarint(3);
+                putVarint(zigzag);
+            } else {
+                putVarint(zigzag << 2);
+            }
+        } else if (token.kind == TraceToken::Real) {
+            putVarint(1);
+            char bytes[sizeof token.real];
+            memcpy(bytes, &token.real, sizeof bytes);
+            buffer.append(bytes, sizeof bytes);
+        } else {
+            putVarint(2);
+        }
+    }
+
+    void writeText(const TraceToken& token) {
+        if (token.kind == TraceToken::EndOfLine) {
+            buffer += '\n';
+            lineStart = true;
+            return;
+        }
+        if (!lineStart) buffer += separator == ',' ? ", " : " ";
+        lineStart = false;
+
+        char text[32];
+        char* end;
+        if (token.kind == TraceToken::Integer) {
+            end = std::to_chars(text, text + sizeof text, token.integer).ptr;
+        } else {
+            // Shortest form that reads back the same, kept recognisable as a real number
+            end = std::to_chars(text, text + sizeof text, token.real).ptr;
+            if (std::find_if(text, end, [](char c) { return c == '.' || c == 'e' || c == 'n' || c == 'i'; }) == end) {
+                *end++ = '.';
+                *end++ = '0';
+            }
+        }
+        buffer.append(text, end);
+    }
+};
+
+#endif
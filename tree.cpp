@@ -4,6 +4,28 @@
 #include <filesystem>
 #include <cstdlib>
 #include <memory>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <string_view>
+#include <cstring>
+#include <cerrno>
+#include <charconv>
+#include <malloc.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <random>
+#include <poll.h>
+#include <sys/inotify.h>
 
 using namespace std;
 namespace fs = std::filesystem;
@@ -14,95 +36,1634 @@ struct Node {
     string permissions;
     size_t size;
     vector<shared_ptr<Node>> children;
+    uint64_t blocks = 0;   // 512-byte blocks allocated, only filled in by aggregation
 
     Node(const string& name, bool is_directory, const string& permissions, size_t size)
         : name(name), is_directory(is_directory), permissions(permissions), size(size) {}
 };
 
+// Work-stealing pool used by the parallel walk. Each worker owns a deque: it pushes and
+// pops its own tasks at the back, so it keeps descending into the subtree it just listed,
+// while idle workers steal from the front, where the oldest (usually largest) subtrees wait.
+template <typename Task>
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(size_t workers) : queues(workers) {}
+
+    // Runs process(task, worker) until no task is queued or running. process may push
+    // further tasks onto its own worker's deque. The first exception thrown by a task is
+    // rethrown here once all workers have stopped.
+    template <typename Process>
+    void run(Task root, Process process) {
+        push(0, move(root));
+        vector<thread> threads;
+        for (size_t id = 1; id < queues.size(); ++id) {
+            threads.emplace_back([this, id, &process] { work(id, process); });
+        }
+        work(0, process);
+        for (auto& t : threads) t.join();
+        if (error) rethrow_exception(error);
+    }
+
+    void push(size_t worker, Task task) {
+        pending.fetch_add(1, memory_order_relaxed);
+        lock_guard<mutex> lock(queues[worker].lock);
+        queues[worker].tasks.push_back(move(task));
+    }
+
+private:
+    struct WorkQueue {
+        mutex lock;
+        deque<Task> tasks;
+    };
+
+    vector<WorkQueue> queues;
+    atomic<size_t> pending{0};   // queued plus running tasks
+    atomic<bool> failed{false};
+    mutex error_lock;
+    exception_ptr error;
+
+    bool take(size_t worker, Task& task) {
+        {
+            lock_guard<mutex> lock(queues[worker].lock);
+            if (!queues[worker].tasks.empty()) {
+                task = move(queues[worker].tasks.back());
+                queues[worker].tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); ++i) {
+            WorkQueue& victim = queues[(worker + i) % queues.size()];
+            lock_guard<mutex> lock(victim.lock);
+            if (!victim.tasks.empty()) {
+                task = move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template <typename Process>
+    void work(size_t worker, Process& process) {
+        Task task;
+        while (pending.load(memory_order_acquire) != 0) {
+            if (!take(worker, task)) {
+                this_thread::yield();
+                continue;
+            }
+            // After a failure the remaining tasks are drained without being run.
+            if (!failed.load(memory_order_relaxed)) {
+                try {
+                    process(task, worker);
+                } catch (...) {
+                    lock_guard<mutex> lock(error_lock);
+                    if (!error) error = current_exception();
+                    failed = true;
+                }
+            }
+            // Children were pushed (and counted) before their parent is retired, so
+            // pending only reaches zero once the whole walk is done.
+            pending.fetch_sub(1, memory_order_acq_rel);
+        }
+    }
+};
+
+void print_node(const shared_ptr<Node>& node, bool show_all, bool show_details, int level) {
+    if (!show_all && node->name.find('.') == 0) return;
+
+    for (int i = 0; i < level; ++i) cout << "  ";
+    if (show_details) {
+        cout << (node->is_directory ? "[DIR] " : "[FILE] ") << node->name 
+             << " (" << node->size << " bytes, " << node->permissions << ")\n";
+    } else {
+        cout << node->name << "\n";
+    }
+
+    for (const auto& child : node->children) {
+        print_node(child, show_all, show_details, level + 1);
+    }
+}
+
+// Formats the owner/group/other rwx bits of a raw st_mode, e.g. "rwxr-xr-x".
+string format_permissions(mode_t mode) {
+    string permissions = "---------";
+    const mode_t bits[] = {S_IRUSR, S_IWUSR, S_IXUSR, S_IRGRP, S_IWGRP, S_IXGRP, S_IROTH, S_IWOTH, S_IXOTH};
+    for (int i = 0; i < 9; ++i) {
+        if (mode & bits[i]) permissions[i] = "rwx"[i % 3];
+    }
+    return permissions;
+}
+
+// (device, inode) pairs seen by the walk, used to count each hard-linked file once.
+// Workers insert concurrently, so the set is split into shards with their own locks.
+class InodeSet {
+public:
+    InodeSet() : shards(64) {}
+
+    // Returns false if the inode was inserted before.
+    bool insert(dev_t device, ino_t inode) {
+        Shard& shard = shards[(static_cast<uint64_t>(inode) * 0x9E3779B97F4A7C15ull) >> 58];
+        lock_guard<mutex> lock(shard.lock);
+        return shard.inodes.emplace(device, inode).second;
+    }
+
+private:
+    struct InodeHash {
+        size_t operator()(const pair<dev_t, ino_t>& key) const {
+            return hash<uint64_t>()(static_cast<uint64_t>(key.second) ^ (static_cast<uint64_t>(key.first) << 40));
+        }
+    };
+
+    struct Shard {
+        mutex lock;
+        unordered_set<pair<dev_t, ino_t>, InodeHash> inodes;
+    };
+
+    vector<Shard> shards;
+};
+
 class DirectoryTree {
 public:
-    explicit DirectoryTree(const fs::path& root) : root_path(root) {
+    // A directory and its rolled-up totals, as reported by largest_subtrees.
+    struct Subtree {
+        uint64_t size;     // apparent bytes
+        uint64_t blocks;   // 512-byte blocks allocated
+        string path;
+    };
+
+    // jobs > 1 walks the hierarchy on a work-stealing pool. Every directory is still
+    // listed by exactly one worker in directory_iterator order, so the resulting tree,
+    // and therefore the printed output, is the same as the serial walk's.
+    //
+    // aggregate counts like du: symlinks are not followed, every directory's size and
+    // blocks become the totals of its subtree, including its own entry, and a file with
+    // several hard links in the tree is counted at the first one reached. The totals do
+    // not depend on jobs, but which subtree a shared file is charged to may.
+    explicit DirectoryTree(const fs::path& root, size_t jobs = 1, bool aggregate = false)
+        : root_path(root), aggregate(aggregate) {
         if (!fs::exists(root)) {
             throw runtime_error("Directory does not exist: " + root.string());
         }
-        build_tree(root, root_node);
+        if (aggregate) {
+            struct stat st;
+            if (stat(root.c_str(), &st) != 0) {
+                throw runtime_error("Cannot stat: " + root.string());
+            }
+            root_node->size = static_cast<size_t>(st.st_size);
+            root_node->blocks = static_cast<uint64_t>(st.st_blocks);
+        }
+        if (jobs > 1) {
+            build_tree_parallel(jobs);
+        } else {
+            build_tree(root, root_node);
+        }
     }
 
     void print_tree(bool show_all, bool show_details, int level = 0) {
         print_node(root_node, show_all, show_details, level);
     }
 
+    size_t entry_count() const { return entries; }
+
+    // Hard links skipped because their inode had already been counted.
+    size_t shared_link_count() const { return shared_links; }
+
+    const shared_ptr<Node>& root() const { return root_node; }
+
+    // The count directories below the root with the most blocks allocated, largest first.
+    // Candidates go through a bounded min-heap, so only the winners are ever sorted.
+    vector<Subtree> largest_subtrees(size_t count) const {
+        vector<Subtree> heap;
+        if (count == 0) return heap;
+        string path = root_path.string();
+        for (const auto& child : root_node->children) {
+            collect_subtrees(*child, path, count, heap);
+        }
+        sort_heap(heap.begin(), heap.end(), larger_subtree);
+        return heap;
+    }
+
 private:
+    using Subdirectory = pair<fs::path, shared_ptr<Node>>;
+
+    // A directory of the parallel walk. pending counts its unfinished subdirectories plus
+    // one for its own listing; subdirectory totals accumulate in size and blocks, and
+    // whichever worker drops pending to zero rolls them into the node and the parent.
+    struct Frame {
+        fs::path path;
+        shared_ptr<Node> node;
+        shared_ptr<Frame> parent;
+        atomic<size_t> pending{1};
+        atomic<uint64_t> size{0};
+        atomic<uint64_t> blocks{0};
+    };
+
     fs::path root_path;
+    bool aggregate;
     shared_ptr<Node> root_node = make_shared<Node>(root_path.filename().string(), true, "-", 0);
+    atomic<size_t> entries{0};
+    atomic<size_t> shared_links{0};
+    InodeSet hard_links;
 
     void build_tree(const fs::path& path, shared_ptr<Node>& node) {
+        for (auto& subdir : list_directory(path, *node)) {
+            build_tree(subdir.first, subdir.second);
+            node->size += subdir.second->size;
+            node->blocks += subdir.second->blocks;
+        }
+    }
+
+    void build_tree_parallel(size_t jobs) {
+        WorkStealingPool<shared_ptr<Frame>> pool(jobs);
+        auto root = make_shared<Frame>();
+        root->path = root_path;
+        root->node = root_node;
+        pool.run(root, [&](shared_ptr<Frame>& frame, size_t worker) {
+            auto subdirs = list_directory(frame->path, *frame->node);
+            frame->pending.fetch_add(subdirs.size(), memory_order_relaxed);
+            for (auto& subdir : subdirs) {
+                auto child = make_shared<Frame>();
+                child->path = move(subdir.first);
+                child->node = move(subdir.second);
+                child->parent = frame;
+                pool.push(worker, move(child));
+            }
+            finish(frame.get());
+        });
+    }
+
+    // Retires one unit of a frame's pending count and, when it was the last, passes the
+    // finished totals up, continuing with every ancestor that this completes in turn.
+    static void finish(Frame* frame) {
+        while (frame->pending.fetch_sub(1, memory_order_acq_rel) == 1) {
+            Node& node = *frame->node;
+            node.size += frame->size.load(memory_order_relaxed);
+            node.blocks += frame->blocks.load(memory_order_relaxed);
+            Frame* parent = frame->parent.get();
+            if (!parent) return;
+            parent->size.fetch_add(node.size, memory_order_relaxed);
+            parent->blocks.fetch_add(node.blocks, memory_order_relaxed);
+            frame = parent;
+        }
+    }
+
+    // Fills node.children from one directory and returns the subdirectories that still
+    // have to be walked. Only the caller touches node, so workers need no locking here.
+    // With aggregation, the files' totals are added to node's straight away.
+    vector<Subdirectory> list_directory(const fs::path& path, Node& node) {
+        vector<Subdirectory> subdirs;
         for (const auto& entry : fs::directory_iterator(path)) {
-            if (entry.is_directory()) {
-                auto child = make_shared<Node>(
-                    entry.path().filename().string(), true, get_permissions(entry.path()), 0);
-                build_tree(entry.path(), child);
-                node->children.push_back(child);
+            // Without aggregation symlinks are followed; a dangling one is shown as itself.
+            struct stat st;
+            const char* entry_path = entry.path().c_str();
+            int result = aggregate ? lstat(entry_path, &st) : stat(entry_path, &st);
+            if (result != 0 && !aggregate && errno == ENOENT) result = lstat(entry_path, &st);
+            if (result != 0) {
+                throw runtime_error("Cannot stat " + entry.path().string() + ": " + strerror(errno));
+            }
+
+            bool is_directory = S_ISDIR(st.st_mode);
+            auto child = make_shared<Node>(entry.path().filename().string(), is_directory,
+                                           format_permissions(st.st_mode),
+                                           is_directory && !aggregate ? 0 : static_cast<size_t>(st.st_size));
+            node.children.push_back(child);
+            if (is_directory) {
+                subdirs.emplace_back(entry.path(), child);
+            }
+            if (!aggregate) continue;
+
+            child->blocks = static_cast<uint64_t>(st.st_blocks);
+            if (is_directory) continue;   // added once its subtree is done
+            if (st.st_nlink > 1 && !hard_links.insert(st.st_dev, st.st_ino)) {
+                shared_links.fetch_add(1, memory_order_relaxed);
+                continue;
+            }
+            node.size += child->size;
+            node.blocks += child->blocks;
+        }
+        entries.fetch_add(node.children.size(), memory_order_relaxed);
+        return subdirs;
+    }
+
+    static bool larger_subtree(const Subtree& a, const Subtree& b) {
+        return a.blocks != b.blocks ? a.blocks > b.blocks : a.size > b.size;
+    }
+
+    static void collect_subtrees(const Node& node, string& path, size_t count, vector<Subtree>& heap) {
+        if (!node.is_directory) return;
+        size_t length = path.size();
+        path += '/';
+        path += node.name;
+        // heap.front() is the smallest of the current winners.
+        Subtree candidate = {node.size, node.blocks, {}};
+        if (heap.size() < count || larger_subtree(candidate, heap.front())) {
+            candidate.path = path;
+            if (heap.size() == count) {
+                pop_heap(heap.begin(), heap.end(), larger_subtree);
+                heap.back() = move(candidate);
             } else {
-                auto child = make_shared<Node>(
-                    entry.path().filename().string(), false, get_permissions(entry.path()), fs::file_size(entry.path()));
-                node->children.push_back(child);
+                heap.push_back(move(candidate));
+            }
+            push_heap(heap.begin(), heap.end(), larger_subtree);
+        }
+        for (const auto& child : node.children) {
+            collect_subtrees(*child, path, count, heap);
+        }
+        path.resize(length);
+    }
+};
+
+// Interned entry names. Each distinct name is stored once in a single buffer as a length
+// byte (names are at most NAME_MAX bytes) followed by its bytes, and is referred to by
+// the offset of that length byte. The hash table only exists while the tree is built.
+class NamePool {
+public:
+    uint32_t intern(string_view name) {
+        if (slots.empty() || (interned + 1) * 2 > slots.size()) grow();
+
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash<string_view>{}(name) & mask;; i = (i + 1) & mask) {
+            if (slots[i] == 0) {
+                uint32_t offset = static_cast<uint32_t>(bytes.size());
+                bytes.push_back(static_cast<char>(name.size()));
+                bytes.insert(bytes.end(), name.begin(), name.end());
+                slots[i] = offset + 1;
+                ++interned;
+                return offset;
+            }
+            if (get(slots[i] - 1) == name) return slots[i] - 1;
+        }
+    }
+
+    string_view get(uint32_t offset) const { return read(bytes.data(), offset); }
+
+    // Decodes the name at offset from raw pool bytes, e.g. a mapped snapshot.
+    static string_view read(const char* pool, uint32_t offset) {
+        return string_view(pool + offset + 1, static_cast<unsigned char>(pool[offset]));
+    }
+
+    const vector<char>& data() const { return bytes; }
+
+    // Drops the intern table once no more names will be added.
+    void seal() {
+        vector<uint32_t>().swap(slots);
+        bytes.shrink_to_fit();
+    }
+
+private:
+    vector<char> bytes;
+    vector<uint32_t> slots;   // offset + 1 of an interned name, 0 for an empty slot
+    size_t interned = 0;
+
+    void grow() {
+        vector<uint32_t> old = move(slots);
+        slots.assign(max<size_t>(1024, old.size() * 2), 0);
+        size_t mask = slots.size() - 1;
+        for (uint32_t slot : old) {
+            if (slot == 0) continue;
+            size_t i = hash<string_view>{}(get(slot - 1)) & mask;
+            while (slots[i] != 0) i = (i + 1) & mask;
+            slots[i] = slot;
+        }
+    }
+};
+
+// Node of the compact engine. The children of a directory are stored next to each other
+// in the arena, so a range replaces the vector of pointers.
+struct CompactNode {
+    union {
+        uint64_t size;      // files
+        int64_t mtime;      // directories: st_mtim in ns, checked by incremental refresh
+    };
+    uint32_t name;          // offset into the NamePool
+    uint32_t first_child;   // children are nodes [first_child, first_child + child_count)
+    uint32_t child_count;
+    uint32_t mode;          // raw st_mode, 0 for the root (printed as "-" like Node)
+};
+
+static_assert(sizeof(CompactNode) == 24, "CompactNode should stay three words");
+
+int64_t mtime_ns(const struct stat& st) {
+    return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+// Directory mtime to remember for later comparison. Timestamps come from a coarse clock,
+// so a change landing in the same tick as this stat would not move the mtime; an mtime
+// that recent is recorded as 0, which refresh_tree always treats as changed.
+int64_t recorded_mtime(const struct stat& st) {
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    int64_t now_ns = static_cast<int64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+    int64_t mtime = mtime_ns(st);
+    return now_ns - mtime < 100000000 ? 0 : mtime;
+}
+
+// On-disk layout of a saved CompactDirectoryTree: this header, the absolute root path,
+// the node arena and the name pool, each section starting on an 8-byte boundary.
+struct SnapshotHeader {
+    char magic[8];
+    uint64_t root_length;
+    uint64_t node_count;
+    uint64_t names_size;
+};
+
+const char snapshot_magic[8] = {'D', 'T', 'S', 'N', 'A', 'P', '1', '\0'};
+
+size_t align8(size_t size) { return (size + 7) & ~size_t(7); }
+
+// Read-only mapping of a snapshot written by CompactDirectoryTree::save. Everything is
+// checked once here, bounds and that children come after their parent as save lays
+// them out, so walking the mapped arena afterwards needs no checks and cannot loop.
+class SnapshotFile {
+public:
+    explicit SnapshotFile(const fs::path& file) {
+        int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            throw runtime_error("Cannot open snapshot: " + file.string());
+        }
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(SnapshotHeader))) {
+            length = st.st_size;
+            data = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) data = nullptr;
+        }
+        close(fd);
+        if (!data || !parse()) {
+            if (data) munmap(data, length);
+            throw runtime_error("Not a valid snapshot: " + file.string());
+        }
+    }
+
+    ~SnapshotFile() { munmap(data, length); }
+
+    SnapshotFile(const SnapshotFile&) = delete;
+    SnapshotFile& operator=(const SnapshotFile&) = delete;
+
+    string_view root() const { return root_path; }
+    const CompactNode& node(uint32_t index) const { return nodes[index]; }
+    string_view name(uint32_t index) const { return NamePool::read(names, nodes[index].name); }
+
+private:
+    void* data = nullptr;
+    size_t length = 0;
+    string_view root_path;
+    const CompactNode* nodes = nullptr;
+    const char* names = nullptr;
+
+    bool parse() {
+        const char* base = static_cast<const char*>(data);
+        SnapshotHeader header;
+        memcpy(&header, base, sizeof(header));
+        if (memcmp(header.magic, snapshot_magic, sizeof(snapshot_magic)) != 0 || header.node_count == 0 ||
+            header.root_length > length || header.node_count > length / sizeof(CompactNode) ||
+            header.names_size > length) {
+            return false;
+        }
+        size_t root_offset = sizeof(SnapshotHeader);
+        size_t nodes_offset = align8(root_offset + header.root_length);
+        size_t names_offset = nodes_offset + header.node_count * sizeof(CompactNode);
+        if (names_offset + header.names_size > length) return false;
+
+        root_path = string_view(base + root_offset, header.root_length);
+        nodes = reinterpret_cast<const CompactNode*>(base + nodes_offset);
+        names = base + names_offset;
+
+        for (uint64_t i = 0; i < header.node_count; ++i) {
+            const CompactNode& node = nodes[i];
+            if (node.name >= header.names_size ||
+                node.name + 1 + static_cast<unsigned char>(names[node.name]) > header.names_size ||
+                node.first_child > header.node_count || node.child_count > header.node_count - node.first_child ||
+                (node.child_count > 0 && node.first_child <= i)) {
+                return false;
             }
         }
+        return true;
     }
+};
+
+// Second storage engine for the same tree: every node lives in one contiguous arena,
+// names are interned and permissions are kept as mode bits until they are printed.
+// It prints exactly what DirectoryTree prints.
+class CompactDirectoryTree {
+public:
+    explicit CompactDirectoryTree(const fs::path& root) {
+        int fd = open_root(root);
+        build_tree(fd, root.string(), 0);
+        names.seal();
+        nodes.shrink_to_fit();
+    }
+
+    // Incremental refresh against a previous snapshot of the same root. A directory whose
+    // mtime still matches the snapshot has the same entries, so its children are copied
+    // from the snapshot instead of being read and stat'ed again; only its subdirectories
+    // are stat'ed to check their own mtimes. Files inside unchanged directories keep the
+    // size and mode recorded in the snapshot.
+    CompactDirectoryTree(const fs::path& root, const SnapshotFile& previous) {
+        int fd = open_root(root);
+        refresh_tree(fd, root.string(), 0, previous, 0);
+        names.seal();
+        nodes.shrink_to_fit();
+    }
+
+    void print_tree(bool show_all, bool show_details) {
+        print_node(0, show_all, show_details, 0);
+    }
+
+    size_t entry_count() const { return nodes.size() - 1; }
+
+    // Writes the arena through a shared mapping of a temporary file that is renamed over
+    // file, so a reader never sees a half-written snapshot.
+    void save(const fs::path& file, const string& absolute_root) const {
+        const vector<char>& name_bytes = names.data();
+        size_t nodes_offset = align8(sizeof(SnapshotHeader) + absolute_root.size());
+        size_t names_offset = nodes_offset + nodes.size() * sizeof(CompactNode);
+        size_t length = names_offset + name_bytes.size();
+
+        fs::path temporary = file;
+        temporary += ".tmp";
+        int fd = open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1) {
+            throw runtime_error("Cannot create snapshot: " + temporary.string());
+        }
+        void* data = MAP_FAILED;
+        if (ftruncate(fd, length) == 0) {
+            data = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (data == MAP_FAILED) {
+            unlink(temporary.c_str());
+            throw runtime_error("Cannot map snapshot: " + temporary.string());
+        }
+
+        char* base = static_cast<char*>(data);
+        SnapshotHeader header = {};
+        memcpy(header.magic, snapshot_magic, sizeof(snapshot_magic));
+        header.root_length = absolute_root.size();
+        header.node_count = nodes.size();
+        header.names_size = name_bytes.size();
+        memcpy(base, &header, sizeof(header));
+        memcpy(base + sizeof(header), absolute_root.data(), absolute_root.size());
+        memcpy(base + nodes_offset, nodes.data(), nodes.size() * sizeof(CompactNode));
+        memcpy(base + names_offset, name_bytes.data(), name_bytes.size());
+        munmap(data, length);
 
-    string get_permissions(const fs::path& path) {
-        fs::perms p = fs::status(path).permissions();
-        string permissions;
+        if (rename(temporary.c_str(), file.c_str()) == -1) {
+            unlink(temporary.c_str());
+            throw runtime_error("Cannot replace snapshot: " + file.string());
+        }
+    }
 
-        permissions += (p & fs::perms::owner_read)  ? "r" : "-";
-        permissions += (p & fs::perms::owner_write) ? "w" : "-";
-        permissions += (p & fs::perms::owner_exec)  ? "x" : "-";
-        permissions += (p & fs::perms::group_read)  ? "r" : "-";
-        permissions += (p & fs::perms::group_write) ? "w" : "-";
-        permissions += (p & fs::perms::group_exec)  ? "x" : "-";
-        permissions += (p & fs::perms::others_read) ? "r" : "-";
-        permissions += (p & fs::perms::others_write) ? "w" : "-";
-        permissions += (p & fs::perms::others_exec) ? "x" : "-";
+private:
+    vector<CompactNode> nodes;
+    NamePool names;
 
-        return permissions;
+    // Opens the root and records it as node 0. Returns the directory fd.
+    int open_root(const fs::path& root) {
+        if (!fs::exists(root)) {
+            throw runtime_error("Directory does not exist: " + root.string());
+        }
+        int fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        struct stat st;
+        if (fd == -1 || fstat(fd, &st) == -1) {
+            if (fd != -1) close(fd);
+            throw runtime_error("Cannot open directory: " + root.string());
+        }
+        CompactNode node = {};
+        node.mtime = recorded_mtime(st);
+        node.name = names.intern(root.filename().string());
+        nodes.push_back(node);
+        return fd;
     }
 
-    void print_node(const shared_ptr<Node>& node, bool show_all, bool show_details, int level) {
-        if (!show_all && node->name.find('.') == 0) return;
+    bool is_directory(uint32_t index) const {
+        return index == 0 || S_ISDIR(nodes[index].mode);
+    }
+
+    // Stats name in the directory open on fd into node, following symlinks like
+    // fs::status; a dangling link is kept as the link itself.
+    static bool stat_entry(int fd, const char* name, CompactNode& node) {
+        struct stat st;
+        if (fstatat(fd, name, &st, 0) == -1 && fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+            return false;
+        }
+        node.mode = static_cast<uint32_t>(st.st_mode);
+        if (S_ISDIR(st.st_mode)) {
+            node.mtime = recorded_mtime(st);
+        } else {
+            node.size = static_cast<uint64_t>(st.st_size);
+        }
+        return true;
+    }
+
+    static DIR* open_directory(int fd, const string& path) {
+        DIR* dir = fdopendir(fd);
+        if (!dir) {
+            close(fd);
+            throw runtime_error("Cannot open directory: " + path);
+        }
+        return dir;
+    }
+
+    static int open_subdirectory(DIR* dir, const string& path, const string& name) {
+        int child_fd = openat(dirfd(dir), name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (child_fd == -1) {
+            closedir(dir);
+            throw runtime_error("Cannot open directory: " + path + "/" + name);
+        }
+        return child_fd;
+    }
+
+    // Appends every entry of dir as one contiguous run of children of nodes[index].
+    void read_entries(DIR* dir, const string& path, uint32_t index) {
+        uint32_t first = static_cast<uint32_t>(nodes.size());
+        while (dirent* entry = readdir(dir)) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+            CompactNode node = {};
+            if (!stat_entry(dirfd(dir), entry->d_name, node)) {
+                closedir(dir);
+                throw runtime_error("Cannot stat: " + path + "/" + entry->d_name);
+            }
+            node.name = names.intern(entry->d_name);
+            nodes.push_back(node);
+        }
+        nodes[index].first_child = first;
+        nodes[index].child_count = static_cast<uint32_t>(nodes.size()) - first;
+    }
+
+    // Reads the directory open on fd into the children of nodes[index], then descends
+    // into the subdirectories. Takes ownership of fd.
+    void build_tree(int fd, const string& path, uint32_t index) {
+        DIR* dir = open_directory(fd, path);
+        read_entries(dir, path, index);
+
+        uint32_t first = nodes[index].first_child;
+        for (uint32_t child = first; child < first + nodes[index].child_count; ++child) {
+            if (!S_ISDIR(nodes[child].mode)) continue;
+
+            string name(names.get(nodes[child].name));
+            build_tree(open_subdirectory(dir, path, name), path + "/" + name, child);
+        }
+        closedir(dir);
+    }
+
+    // Same as build_tree, but nodes[index] corresponds to snapshot node old_index and its
+    // mtime has just been stat'ed. Takes ownership of fd.
+    void refresh_tree(int fd, const string& path, uint32_t index, const SnapshotFile& previous, uint32_t old_index) {
+        const CompactNode& old = previous.node(old_index);
+        DIR* dir = open_directory(fd, path);
+        uint32_t first = static_cast<uint32_t>(nodes.size());
+        vector<uint32_t> old_match;   // snapshot node of each new child, or 0 if it is new
+
+        if (old.mtime != 0 && old.mtime == nodes[index].mtime) {
+            for (uint32_t old_child = old.first_child; old_child < old.first_child + old.child_count; ++old_child) {
+                CompactNode node = previous.node(old_child);
+                node.name = names.intern(previous.name(old_child));
+                node.first_child = node.child_count = 0;
+                if (S_ISDIR(node.mode)) {
+                    string name(previous.name(old_child));
+                    if (!stat_entry(dirfd(dir), name.c_str(), node)) {
+                        closedir(dir);
+                        throw runtime_error("Cannot stat: " + path + "/" + name);
+                    }
+                }
+                nodes.push_back(node);
+                old_match.push_back(old_child);
+            }
+            nodes[index].first_child = first;
+            nodes[index].child_count = static_cast<uint32_t>(nodes.size()) - first;
+        } else {
+            read_entries(dir, path, index);
+
+            unordered_map<string_view, uint32_t> old_children;
+            for (uint32_t old_child = old.first_child; old_child < old.first_child + old.child_count; ++old_child) {
+                if (S_ISDIR(previous.node(old_child).mode)) old_children.emplace(previous.name(old_child), old_child);
+            }
+            for (uint32_t child = first; child < first + nodes[index].child_count; ++child) {
+                auto match = old_children.find(names.get(nodes[child].name));
+                old_match.push_back(match == old_children.end() ? 0 : match->second);
+            }
+        }
+
+        for (uint32_t child = first; child < first + nodes[index].child_count; ++child) {
+            if (!S_ISDIR(nodes[child].mode)) continue;
+
+            string name(names.get(nodes[child].name));
+            int child_fd = open_subdirectory(dir, path, name);
+            uint32_t old_child = old_match[child - first];
+            if (old_child != 0 && S_ISDIR(previous.node(old_child).mode)) {
+                refresh_tree(child_fd, path + "/" + name, child, previous, old_child);
+            } else {
+                build_tree(child_fd, path + "/" + name, child);
+            }
+        }
+        closedir(dir);
+    }
+
+    void print_node(uint32_t index, bool show_all, bool show_details, int level) {
+        const CompactNode& node = nodes[index];
+        string_view name = names.get(node.name);
+        if (!show_all && name.find('.') == 0) return;
 
         for (int i = 0; i < level; ++i) cout << "  ";
         if (show_details) {
-            cout << (node->is_directory ? "[DIR] " : "[FILE] ") << node->name 
-                 << " (" << node->size << " bytes, " << node->permissions << ")\n";
+            cout << (is_directory(index) ? "[DIR] " : "[FILE] ") << name
+                 << " (" << (is_directory(index) ? 0 : node.size) << " bytes, "
+                 << (node.mode ? format_permissions(node.mode) : "-") << ")\n";
         } else {
-            cout << node->name << "\n";
+            cout << name << "\n";
         }
 
-        for (const auto& child : node->children) {
+        for (uint32_t child = node.first_child; child < node.first_child + node.child_count; ++child) {
             print_node(child, show_all, show_details, level + 1);
         }
     }
 };
 
+// Builds the tree for -f: refreshes it incrementally from the snapshot when one exists
+// for the same root, walks it cold otherwise, and saves the result as the new snapshot.
+// An existing file that is not a snapshot is an error rather than something to replace.
+CompactDirectoryTree refresh_snapshot(const fs::path& root, const fs::path& snapshot_file) {
+    string absolute_root = fs::absolute(root).lexically_normal().string();
+    unique_ptr<SnapshotFile> previous;
+    if (fs::exists(snapshot_file)) {
+        try {
+            previous = make_unique<SnapshotFile>(snapshot_file);
+            if (previous->root() != absolute_root) {
+                cerr << "Snapshot " << snapshot_file << " is for " << previous->root() << ", walking from scratch\n";
+                previous.reset();
+            }
+        } catch (const exception& e) {
+            // Never overwrite a file that is not one of our snapshots.
+            throw runtime_error(string(e.what()) + ", refusing to overwrite it");
+        }
+    }
+
+    CompactDirectoryTree tree = previous ? CompactDirectoryTree(root, *previous) : CompactDirectoryTree(root);
+    previous.reset();
+    tree.save(snapshot_file, absolute_root);
+    return tree;
+}
+
+// Reusable output block for the streaming printer: lines are appended in place and the
+// whole block goes out in a single write() each time it fills up.
+class OutputBuffer {
+public:
+    explicit OutputBuffer(int fd, size_t capacity = 1 << 20) : fd(fd), buffer(capacity) {}
+
+    void append(string_view text) {
+        if (used + text.size() > buffer.size()) {
+            flush();
+            if (text.size() > buffer.size()) {
+                write_all(text.data(), text.size());
+                return;
+            }
+        }
+        memcpy(buffer.data() + used, text.data(), text.size());
+        used += text.size();
+    }
+
+    void append(uint64_t value) {
+        char digits[20];
+        auto result = to_chars(digits, digits + sizeof(digits), value);
+        append(string_view(digits, result.ptr - digits));
+    }
+
+    void flush() {
+        write_all(buffer.data(), used);
+        used = 0;
+    }
+
+private:
+    int fd;
+    vector<char> buffer;
+    size_t used = 0;
+
+    void write_all(const char* data, size_t size) {
+        while (size > 0) {
+            ssize_t written = write(fd, data, size);
+            if (written == -1) {
+                if (errno == EINTR) continue;
+                throw runtime_error(string("Write failed: ") + strerror(errno));
+            }
+            data += written;
+            size -= written;
+        }
+    }
+};
+
+// Prints the listing while walking instead of building a tree first. Only the open
+// directories on the current path are held, so memory is bounded by the depth of the
+// hierarchy, and hidden directories are skipped without being opened unless -a is given.
+// The output matches DirectoryTree::print_tree.
+class StreamingTreePrinter {
+public:
+    StreamingTreePrinter(bool show_all, bool show_details) : show_all(show_all), show_details(show_details) {}
+
+    void print_tree(const fs::path& root) {
+        if (!fs::exists(root)) {
+            throw runtime_error("Directory does not exist: " + root.string());
+        }
+        string name = root.filename().string();
+        if (!show_all && name.find('.') == 0) return;
+
+        int fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd == -1) {
+            throw runtime_error("Cannot open directory: " + root.string());
+        }
+        try {
+            print_line(name, true, 0, "-", 0);
+            walk(fd, root.string(), 1);
+        } catch (...) {
+            out.flush();
+            throw;
+        }
+        out.flush();
+    }
+
+private:
+    bool show_all;
+    bool show_details;
+    OutputBuffer out{STDOUT_FILENO};
+
+    void print_line(string_view name, bool is_directory, uint64_t size, string_view permissions, int level) {
+        for (int i = 0; i < level; ++i) out.append("  ");
+        if (show_details) {
+            out.append(is_directory ? "[DIR] " : "[FILE] ");
+            out.append(name);
+            out.append(" (");
+            out.append(size);
+            out.append(" bytes, ");
+            out.append(permissions);
+            out.append(")\n");
+        } else {
+            out.append(name);
+            out.append("\n");
+        }
+    }
+
+    // Prints the entries of the directory open on fd, descending into each subdirectory
+    // right after its own line. Takes ownership of fd.
+    void walk(int fd, const string& path, int level) {
+        DIR* dir = fdopendir(fd);
+        if (!dir) {
+            close(fd);
+            throw runtime_error("Cannot open directory: " + path);
+        }
+
+        while (dirent* entry = readdir(dir)) {
+            const char* name = entry->d_name;
+            if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) continue;
+            if (!show_all && name[0] == '.') continue;
+
+            // d_type is enough to tell directories apart unless details are printed or
+            // the entry is a symlink, which is followed like fs::status does.
+            struct stat st = {};
+            bool is_directory = entry->d_type == DT_DIR;
+            if (show_details || entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+                if (fstatat(fd, name, &st, 0) == -1 && fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+                    closedir(dir);
+                    throw runtime_error("Cannot stat: " + path + "/" + name);
+                }
+                is_directory = S_ISDIR(st.st_mode);
+            }
+
+            uint64_t size = is_directory ? 0 : static_cast<uint64_t>(st.st_size);
+            print_line(name, is_directory, size, show_details ? format_permissions(st.st_mode) : "", level);
+            if (!is_directory) continue;
+
+            int child_fd = openat(fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (child_fd == -1) {
+                closedir(dir);
+                throw runtime_error("Cannot open directory: " + path + "/" + name);
+            }
+            walk(child_fd, path + "/" + name, level + 1);
+        }
+        closedir(dir);
+    }
+};
+
+// Keeps a Node tree current from inotify events instead of re-walking it. Every directory
+// has a watch; events are read in batches and coalesced per (directory, name), and each
+// dirty name is then reconciled once against what is on disk. Directory renames seen in
+// the same batch move the existing subtree instead of rescanning it.
+class LiveDirectoryTree {
+public:
+    struct Stats {
+        size_t events = 0;      // kernel events read
+        size_t batches = 0;
+        size_t applied = 0;     // names reconciled and directories moved
+        size_t overflows = 0;
+        size_t rescans = 0;     // directories relisted after overflows
+        double apply_seconds = 0;
+    };
+
+    explicit LiveDirectoryTree(const fs::path& root) : root_path(root) {
+        if (!fs::exists(root)) {
+            throw runtime_error("Directory does not exist: " + root.string());
+        }
+        inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd == -1) {
+            throw runtime_error(string("inotify_init1 failed: ") + strerror(errno));
+        }
+        root_node = make_shared<Node>(root.filename().string(), true, "-", 0);
+        scan_directory(root_node, -1, root.string());
+    }
+
+    ~LiveDirectoryTree() { close(inotify_fd); }
+
+    LiveDirectoryTree(const LiveDirectoryTree&) = delete;
+    LiveDirectoryTree& operator=(const LiveDirectoryTree&) = delete;
+
+    int event_fd() const { return inotify_fd; }
+    const Stats& stats() const { return counters; }
+    size_t watch_count() const { return watches.size(); }
+
+    // True while deferred names or an overflow resync are waiting to be retried; callers
+    // should then call process_events again even if no new events arrive.
+    bool has_pending_work() const { return !deferred.empty() || !resync.empty(); }
+
+    // Reads everything queued, keeps collecting while more events arrive within
+    // coalesce_ms, then applies the batch together with any pending retries. Returns the
+    // number of kernel events read.
+    size_t process_events(int coalesce_ms = 10) {
+        vector<Event> batch;
+        read_events(batch);
+        while (!batch.empty() && batch.size() < max_batch) {
+            pollfd pending = {inotify_fd, POLLIN, 0};
+            if (poll(&pending, 1, coalesce_ms) <= 0 || read_events(batch) == 0) break;
+        }
+        if (!batch.empty() || has_pending_work()) apply(batch);
+        return batch.size();
+    }
+
+    // Looks up a path relative to the root; returns nullptr if it is not in the tree.
+    shared_ptr<Node> find(const string& subpath) const {
+        shared_ptr<Node> node = root_node;
+        for (const auto& part : fs::path(subpath)) {
+            if (part.empty() || part == ".") continue;
+            auto watch = watch_of.find(node.get());
+            if (watch == watch_of.end()) return nullptr;
+            const Watch& w = watches.at(watch->second);
+            auto child = w.index.find(part.string());
+            if (child == w.index.end()) return nullptr;
+            node = w.node->children[child->second];
+        }
+        return node;
+    }
+
+private:
+    struct Watch {
+        shared_ptr<Node> node;
+        int parent;                              // wd of the parent directory, -1 for the root
+        int64_t mtime;                           // checked against the disk after an overflow
+        ino_t inode;                             // tells whether path_of still leads here
+        unordered_map<string, size_t> index;     // child name -> position in node->children
+    };
+
+    struct NameHash {
+        size_t operator()(const pair<int, string>& key) const {
+            return hash<string>{}(key.second) * 31 + key.first;
+        }
+    };
+    using NameSet = unordered_set<pair<int, string>, NameHash>;
+
+    struct Event {
+        int wd;
+        uint32_t mask;
+        uint32_t cookie;
+        string name;
+    };
+
+    static constexpr uint32_t watch_mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY |
+                                           IN_ATTRIB | IN_DELETE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW;
+    static constexpr size_t max_batch = 1 << 16;
+
+    fs::path root_path;
+    int inotify_fd;
+    shared_ptr<Node> root_node;
+    unordered_map<int, Watch> watches;
+    unordered_map<const Node*, int> watch_of;
+    NameSet deferred;   // names whose directory path was stale, retried with the next batch
+    unordered_set<int> resync;   // directories still to resynchronize after an overflow
+    Stats counters;
+
+    static bool stat_path(const string& path, struct stat& st) {
+        return stat(path.c_str(), &st) == 0 || lstat(path.c_str(), &st) == 0;
+    }
+
+    static shared_ptr<Node> make_node(const string& name, const struct stat& st) {
+        bool is_directory = S_ISDIR(st.st_mode);
+        return make_shared<Node>(name, is_directory, format_permissions(st.st_mode),
+                                 is_directory ? 0 : static_cast<size_t>(st.st_size));
+    }
+
+    string path_of(int wd) const {
+        const Watch& w = watches.at(wd);
+        return w.parent == -1 ? root_path.string() : path_of(w.parent) + "/" + w.node->name;
+    }
+
+    // Watches the directory at path and lists it into node. The watch is added before the
+    // listing, so entries created meanwhile show up either in the listing or as events.
+    // Symlinked directories are listed as entries but not expanded, since one directory
+    // can only have one watch.
+    void scan_directory(const shared_ptr<Node>& node, int parent, const string& path) {
+        int wd = inotify_add_watch(inotify_fd, path.c_str(), watch_mask);
+        if (wd == -1) {
+            if (errno != ENOTDIR && errno != ENOENT) {
+                cerr << "Cannot watch " << path << ": " << strerror(errno) << "\n";
+            }
+            return;
+        }
+        if (watches.count(wd)) {
+            adopt_directory(node, parent, wd);
+            return;
+        }
+
+        struct stat st = {};
+        stat(path.c_str(), &st);   // before listing, so later changes show up as a newer mtime
+        watches[wd] = {node, parent, recorded_mtime(st), st.st_ino, {}};
+        watch_of[node.get()] = wd;
+        node->children.clear();
+
+        error_code ec;
+        for (fs::directory_iterator it(path, ec), end; !ec && it != end; it.increment(ec)) {
+            string name = it->path().filename().string();
+            struct stat st;
+            if (!stat_path(it->path().string(), st)) continue;   // already gone again
+            auto child = make_node(name, st);
+            add_child(wd, child);
+            if (child->is_directory) scan_directory(child, wd, path + "/" + name);
+        }
+    }
+
+    // The kernel returned a watch we already hold: the directory was renamed and its old
+    // name has not been reconciled yet. Its subtree is moved over to the new node.
+    void adopt_directory(const shared_ptr<Node>& node, int parent, int wd) {
+        Watch& w = watches.at(wd);
+        shared_ptr<Node> old = w.node;
+        if (w.parent != -1) {
+            Watch& old_parent = watches.at(w.parent);
+            auto found = old_parent.index.find(old->name);
+            if (found != old_parent.index.end() && old_parent.node->children[found->second] == old) {
+                detach_child(w.parent, old->name);
+            }
+        }
+        node->children = move(old->children);
+        watch_of.erase(old.get());
+        watch_of[node.get()] = wd;
+        w.node = node;
+        w.parent = parent;
+    }
+
+    void add_child(int wd, const shared_ptr<Node>& child) {
+        Watch& w = watches.at(wd);
+        w.index[child->name] = w.node->children.size();
+        w.node->children.push_back(child);
+    }
+
+    // Unlinks name from its directory without touching watches below it.
+    shared_ptr<Node> detach_child(int wd, const string& name) {
+        Watch& w = watches.at(wd);
+        auto found = w.index.find(name);
+        if (found == w.index.end()) return nullptr;
+
+        auto& children = w.node->children;
+        size_t position = found->second;
+        shared_ptr<Node> child = children[position];
+        w.index.erase(found);
+        if (position + 1 != children.size()) {
+            children[position] = children.back();
+            w.index[children[position]->name] = position;
+        }
+        children.pop_back();
+        return child;
+    }
+
+    void drop_watches(const shared_ptr<Node>& node) {
+        auto watch = watch_of.find(node.get());
+        if (watch == watch_of.end()) return;
+        int wd = watch->second;
+        for (const auto& child : node->children) {
+            if (child->is_directory) drop_watches(child);
+        }
+        inotify_rm_watch(inotify_fd, wd);   // fails harmlessly if the kernel already dropped it
+        watch_of.erase(watch);
+        watches.erase(wd);
+    }
+
+    void remove_child(int wd, const string& name) {
+        if (auto child = detach_child(wd, name)) {
+            if (child->is_directory) drop_watches(child);
+        }
+    }
+
+    // Moves an already known subdirectory, keeping its nodes and watches. Returns false
+    // if the source is not a watched directory, in which case both names are reconciled.
+    bool move_directory(int from, const string& from_name, int to, const string& to_name) {
+        if (!watches.count(from) || !watches.count(to)) return false;
+        Watch& source = watches.at(from);
+        auto found = source.index.find(from_name);
+        if (found == source.index.end() || !watch_of.count(source.node->children[found->second].get())) {
+            return false;
+        }
+
+        shared_ptr<Node> child = detach_child(from, from_name);
+        remove_child(to, to_name);   // a rename may replace an empty directory
+        child->name = to_name;
+        add_child(to, child);
+        watches.at(watch_of.at(child.get())).parent = to;
+        return true;
+    }
+
+    // Paths are rebuilt from node names, so they go stale when an ancestor was renamed and
+    // that event has not been read yet. Checking the inode at the path catches that.
+    bool path_is_current(int wd) const {
+        struct stat st;
+        return stat(path_of(wd).c_str(), &st) == 0 && st.st_ino == watches.at(wd).inode;
+    }
+
+    // Brings one name in a watched directory in line with the disk. Returns false, leaving
+    // the tree alone, if the name is missing because its directory path went stale.
+    bool reconcile(int wd, const string& name) {
+        if (!watches.count(wd)) return true;   // its directory went away earlier in the batch
+        string path = path_of(wd) + "/" + name;
+        struct stat st;
+        bool exists = stat_path(path, st);
+        if (!exists && !path_is_current(wd)) return false;
+
+        Watch& w = watches.at(wd);
+        auto found = w.index.find(name);
+        if (found != w.index.end()) {
+            auto& child = w.node->children[found->second];
+            if (exists && child->is_directory == S_ISDIR(st.st_mode)) {
+                child->permissions = format_permissions(st.st_mode);
+                child->size = child->is_directory ? 0 : static_cast<size_t>(st.st_size);
+                return true;
+            }
+            remove_child(wd, name);
+        }
+        if (!exists) return true;
+
+        auto child = make_node(name, st);
+        add_child(wd, child);
+        if (child->is_directory) scan_directory(child, wd, path);
+        return true;
+    }
+
+    // Resynchronizes one directory after events may have been lost. Every known entry is
+    // stat'ed again, since in-place writes do not touch the directory, but the directory
+    // is only relisted when its mtime shows that entries were added or removed.
+    void rescan_directory(int wd) {
+        string path = path_of(wd);
+        vector<string> names;
+        for (const auto& [name, position] : watches.at(wd).index) names.push_back(name);
+
+        struct stat st = {};
+        stat(path.c_str(), &st);
+        int64_t mtime = recorded_mtime(st);
+        if (mtime_ns(st) != watches.at(wd).mtime) {
+            unordered_set<string> on_disk;
+            error_code ec;
+            for (fs::directory_iterator it(path, ec), end; !ec && it != end; it.increment(ec)) {
+                on_disk.insert(it->path().filename().string());
+            }
+            for (const auto& name : names) {
+                if (!on_disk.count(name)) remove_child(wd, name);
+            }
+            names.assign(on_disk.begin(), on_disk.end());
+            ++counters.rescans;
+        }
+        for (const auto& name : names) {
+            if (!reconcile(wd, name)) deferred.emplace(wd, name);
+        }
+        if (watches.count(wd)) watches.at(wd).mtime = mtime;
+    }
+
+    size_t read_events(vector<Event>& batch) {
+        alignas(inotify_event) char buffer[1 << 16];
+        size_t count = 0;
+        for (;;) {
+            ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
+            if (length == -1) {
+                if (errno == EINTR) continue;
+                if (errno == EAGAIN) break;
+                throw runtime_error(string("Reading inotify events failed: ") + strerror(errno));
+            }
+            for (char* p = buffer; p < buffer + length;) {
+                auto* event = reinterpret_cast<inotify_event*>(p);
+                batch.push_back({event->wd, event->mask, event->cookie, event->len ? event->name : ""});
+                p += sizeof(inotify_event) + event->len;
+                ++count;
+            }
+        }
+        counters.events += count;
+        return count;
+    }
+
+    void apply(const vector<Event>& batch) {
+        auto start = chrono::steady_clock::now();
+        NameSet dirty = move(deferred);
+        deferred.clear();
+        unordered_map<uint32_t, const Event*> moved_from;
+        bool overflow = false;
+
+        for (const Event& event : batch) {
+            if (event.mask & IN_Q_OVERFLOW) {
+                overflow = true;
+                continue;
+            }
+            if ((event.mask & (IN_DELETE_SELF | IN_IGNORED)) && watches.count(event.wd) &&
+                watches.at(event.wd).parent == -1) {
+                throw runtime_error("Watched root was removed: " + root_path.string());
+            }
+            if (event.name.empty()) continue;   // events about a watched directory itself
+
+            if (event.mask & IN_MOVED_FROM) {
+                moved_from[event.cookie] = &event;
+            } else if (event.mask & IN_MOVED_TO) {
+                auto source = moved_from.find(event.cookie);
+                if (source != moved_from.end()) {
+                    if (move_directory(source->second->wd, source->second->name, event.wd, event.name)) {
+                        ++counters.applied;
+                    }
+                    moved_from.erase(source);
+                }
+            }
+            dirty.emplace(event.wd, event.name);
+        }
+
+        // Each directory path is checked once per batch, and again whenever a name turns out
+        // to be missing; names under a stale path wait for the rename event that will make
+        // it current again.
+        unordered_map<int, bool> current;
+        for (const auto& [wd, name] : dirty) {
+            if (!watches.count(wd)) continue;
+            auto known = current.find(wd);
+            if (known == current.end()) known = current.emplace(wd, path_is_current(wd)).first;
+            if (!known->second || !reconcile(wd, name)) {
+                deferred.emplace(wd, name);
+                continue;
+            }
+            ++counters.applied;
+        }
+
+        // Events were dropped and the kernel does not say where, so every directory is
+        // resynchronized: entries are stat'ed again, but only directories whose mtime
+        // changed since they were last listed are relisted. A directory whose path is
+        // stale waits until the rename that moved it has been applied. Applying events
+        // does not update the recorded mtime, since a change whose event was dropped may
+        // already be in it.
+        if (overflow) {
+            ++counters.overflows;
+            for (const auto& [wd, w] : watches) resync.insert(wd);
+        }
+        if (!resync.empty()) {
+            vector<int> ready;
+            for (auto it = resync.begin(); it != resync.end();) {
+                if (!watches.count(*it)) {
+                    it = resync.erase(it);
+                } else {
+                    if (path_is_current(*it)) ready.push_back(*it);
+                    ++it;
+                }
+            }
+            for (int wd : ready) {
+                resync.erase(wd);
+                if (watches.count(wd)) rescan_directory(wd);
+            }
+        }
+        ++counters.batches;
+        counters.apply_seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+};
+
+// Runs -l: builds the tree once, keeps it current from inotify and answers commands read
+// from stdin, one per line, from memory:
+//   list [subpath]      listing of the subtree, honouring -a and -d
+//   details [subpath]   the same listing with details
+//   stats               watch and event counters
+//   quit
+void run_live_mode(const fs::path& directory_path, bool show_all, bool show_details) {
+    LiveDirectoryTree tree(directory_path);
+    cout << "Watching " << tree.watch_count() << " directories under " << directory_path << endl;
+
+    string input;
+    for (;;) {
+        pollfd fds[2] = {{tree.event_fd(), POLLIN, 0}, {STDIN_FILENO, POLLIN, 0}};
+        int ready = poll(fds, 2, tree.has_pending_work() ? 50 : -1);
+        if (ready == -1) {
+            if (errno == EINTR) continue;
+            throw runtime_error(string("poll failed: ") + strerror(errno));
+        }
+        if ((fds[0].revents & POLLIN) || tree.has_pending_work()) tree.process_events();
+        if (!(fds[1].revents & (POLLIN | POLLHUP))) continue;
+
+        char buffer[4096];
+        ssize_t length = read(STDIN_FILENO, buffer, sizeof(buffer));
+        if (length <= 0) return;
+        input.append(buffer, length);
+
+        size_t newline;
+        while ((newline = input.find('\n')) != string::npos) {
+            string line = input.substr(0, newline);
+            input.erase(0, newline + 1);
+
+            string command = line.substr(0, line.find(' '));
+            string argument = line.size() > command.size() ? line.substr(command.size() + 1) : "";
+            if (command == "quit") return;
+            if (command == "list" || command == "details") {
+                auto node = tree.find(argument);
+                if (!node) {
+                    cout << "Not found: " << argument << "\n";
+                } else {
+                    print_node(node, show_all, show_details || command == "details", 0);
+                }
+            } else if (command == "stats") {
+                const auto& stats = tree.stats();
+                cout << "watches " << tree.watch_count() << ", events " << stats.events << ", batches "
+                     << stats.batches << ", applied " << stats.applied << ", overflows " << stats.overflows
+                     << ", rescans " << stats.rescans << "\n";
+            } else if (!command.empty()) {
+                cout << "Unknown command: " << command << "\n";
+            }
+            cout << flush;
+        }
+    }
+}
+
+// Flattens the entries below node into "path type size permissions" lines for comparison.
+void collect_entries(const shared_ptr<Node>& node, const string& path, vector<string>& lines) {
+    for (const auto& child : node->children) {
+        string child_path = path + "/" + child->name;
+        lines.push_back(child_path + (child->is_directory ? " d " : " f ") + to_string(child->size) + " " +
+                        child->permissions);
+        collect_entries(child, child_path, lines);
+    }
+}
+
+// Stress test for -l: a writer thread creates, appends to, renames and deletes files and
+// directories under a scratch directory while this thread applies the resulting events.
+// Reports event-apply throughput (kernel events per second spent applying batches, so
+// waiting for the writer does not count) and checks the live tree against a fresh walk.
+void run_live_stress(const fs::path& directory_path, size_t operations) {
+    LiveDirectoryTree tree(directory_path);
+    string area_name = "live-stress-" + to_string(getpid());
+    fs::path area = directory_path / area_name;
+    fs::create_directory(area);
+
+    atomic<bool> done{false};
+    thread writer([&] {
+        mt19937 rng(42);
+        vector<string> dirs = {area.string()};
+        vector<pair<size_t, string>> files;   // (index into dirs, name)
+        size_t next_id = 0;
+        auto file_path = [&](const pair<size_t, string>& file) { return dirs[file.first] + "/" + file.second; };
+
+        for (size_t i = 0; i < operations; ++i) {
+            string fresh = "n" + to_string(next_id++);
+            size_t dir = rng() % dirs.size();
+            switch (rng() % 20) {
+            case 0: case 1: case 2: case 3: case 4: case 5: {
+                int fd = open((dirs[dir] + "/" + fresh).c_str(), O_WRONLY | O_CREAT, 0644);
+                if (fd != -1) close(fd);
+                files.emplace_back(dir, fresh);
+                break;
+            }
+            case 6: case 7: case 8: case 9:
+                if (!files.empty()) {
+                    int fd = open(file_path(files[rng() % files.size()]).c_str(), O_WRONLY | O_APPEND);
+                    if (fd != -1) {
+                        if (write(fd, "data\n", 5) != 5) perror("write");
+                        close(fd);
+                    }
+                }
+                break;
+            case 10: case 11: case 12:
+                if (!files.empty()) {
+                    auto& file = files[rng() % files.size()];
+                    if (rename(file_path(file).c_str(), (dirs[dir] + "/" + fresh).c_str()) == 0) file = {dir, fresh};
+                }
+                break;
+            case 13: case 14: case 15:
+                if (!files.empty()) {
+                    size_t victim = rng() % files.size();
+                    unlink(file_path(files[victim]).c_str());
+                    files[victim] = files.back();
+                    files.pop_back();
+                }
+                break;
+            case 16: case 17: case 18:
+                if (mkdir((dirs[dir] + "/" + fresh).c_str(), 0755) == 0) dirs.push_back(dirs[dir] + "/" + fresh);
+                break;
+            case 19:
+                // Renames a directory in place; every tracked path below it moves along.
+                if (dir != 0) {
+                    string from = dirs[dir];
+                    string to = from.substr(0, from.rfind('/') + 1) + fresh;
+                    if (rename(from.c_str(), to.c_str()) == 0) {
+                        for (auto& path : dirs) {
+                            if (path == from || path.compare(0, from.size() + 1, from + "/") == 0) {
+                                path = to + path.substr(from.size());
+                            }
+                        }
+                    }
+                }
+                break;
+            }
+        }
+        done = true;
+    });
+
+    auto last_event = chrono::steady_clock::now();
+    for (;;) {
+        pollfd pending = {tree.event_fd(), POLLIN, 0};
+        if (poll(&pending, 1, 50) > 0 || tree.has_pending_work()) {
+            if (tree.process_events() > 0) last_event = chrono::steady_clock::now();
+        } else if (done && chrono::steady_clock::now() - last_event > chrono::milliseconds(200)) {
+            break;
+        }
+    }
+    writer.join();
+
+    vector<string> live, fresh;
+    if (auto node = tree.find(area_name)) collect_entries(node, area_name, live);
+    DirectoryTree walked(area);
+    collect_entries(walked.root(), area_name, fresh);
+    sort(live.begin(), live.end());
+    sort(fresh.begin(), fresh.end());
+    fs::remove_all(area);
+
+    const auto& stats = tree.stats();
+    cout << "operations  events  batches  applied  overflows  rescans  seconds   events/sec\n";
+    cout << operations << "\t    " << stats.events << "\t    " << stats.batches << "\t     " << stats.applied
+         << "\t      " << stats.overflows << "\t " << stats.rescans << "\t  " << stats.apply_seconds << "  "
+         << static_cast<size_t>(stats.events / max(stats.apply_seconds, 1e-9)) << "\n";
+    cout << (live == fresh ? "Live tree matches a fresh walk (" : "MISMATCH against a fresh walk (")
+         << fresh.size() << " entries)\n";
+}
+
+// Runs -u: rolls sizes up like du and prints the totals and the count largest subtrees,
+// ranked by allocated bytes.
+void run_disk_usage(const fs::path& directory_path, size_t jobs, size_t count) {
+    DirectoryTree tree(directory_path, jobs, true);
+    const Node& root = *tree.root();
+    cout << directory_path.string() << ": " << root.blocks * 512 << " bytes allocated, " << root.size
+         << " bytes apparent, " << tree.entry_count() << " entries";
+    if (tree.shared_link_count() > 0) {
+        cout << " (" << tree.shared_link_count() << " repeated hard links counted once)";
+    }
+    cout << "\n\nallocated      apparent       subtree\n";
+    for (const auto& subtree : tree.largest_subtrees(count)) {
+        string allocated = to_string(subtree.blocks * 512);
+        string apparent = to_string(subtree.size);
+        cout << allocated << string(max<size_t>(1, 15 - allocated.size()), ' ') << apparent
+             << string(max<size_t>(1, 15 - apparent.size()), ' ') << subtree.path << "\n";
+    }
+}
+
+// Heap bytes currently handed out by malloc, including blocks served by mmap.
+size_t heap_in_use() {
+    struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+}
+
+// Builds the same tree with both storage engines and reports heap bytes per entry and
+// build time. Both builds are serial so the numbers compare storage, not parallelism.
+void run_storage_benchmark(const fs::path& directory_path) {
+    cout << "\nengine   entries   bytes/node  seconds\n";
+
+    auto report = [](const char* engine, size_t entries, size_t bytes, chrono::duration<double> elapsed) {
+        cout << engine << "\t " << entries << "\t   " << bytes / max<size_t>(1, entries)
+             << "\t       " << elapsed.count() << "\n";
+    };
+
+    {
+        size_t before = heap_in_use();
+        auto start = chrono::steady_clock::now();
+        DirectoryTree tree(directory_path);
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        report("node", tree.entry_count(), heap_in_use() - before, elapsed);
+    }
+    {
+        size_t before = heap_in_use();
+        auto start = chrono::steady_clock::now();
+        CompactDirectoryTree tree(directory_path);
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+        report("compact", tree.entry_count(), heap_in_use() - before, elapsed);
+    }
+}
+
+// Times a cold walk that saves a snapshot against an incremental refresh from it.
+void run_snapshot_benchmark(const fs::path& directory_path) {
+    string absolute_root = fs::absolute(directory_path).lexically_normal().string();
+    fs::path snapshot_file = fs::temp_directory_path() / ("tree-benchmark-" + to_string(getpid()) + ".snapshot");
+
+    auto start = chrono::steady_clock::now();
+    CompactDirectoryTree cold(directory_path);
+    cold.save(snapshot_file, absolute_root);
+    chrono::duration<double> cold_time = chrono::steady_clock::now() - start;
+
+    start = chrono::steady_clock::now();
+    SnapshotFile previous(snapshot_file);
+    CompactDirectoryTree refreshed(directory_path, previous);
+    chrono::duration<double> refresh_time = chrono::steady_clock::now() - start;
+    fs::remove(snapshot_file);
+
+    cout << "\nsnapshot  entries   seconds\n";
+    cout << "cold\t  " << cold.entry_count() << "\t    " << cold_time.count() << "\n";
+    cout << "refresh\t  " << refreshed.entry_count() << "\t    " << refresh_time.count() << "\n";
+}
+
+// Builds the tree at 1, 2, 4, ... up to max_jobs threads and reports walk throughput.
+// One untimed walk runs first so every measurement sees the same warm dentry cache.
+void run_scaling_benchmark(const fs::path& directory_path, size_t max_jobs) {
+    DirectoryTree warmup(directory_path);
+    cout << "Walking " << warmup.entry_count() << " entries under " << directory_path << "\n";
+    cout << "threads  seconds     entries/sec\n";
+
+    for (size_t jobs = 1;; jobs = min(jobs * 2, max_jobs)) {
+        auto start = chrono::steady_clock::now();
+        DirectoryTree tree(directory_path, jobs);
+        chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+        cout << jobs << "\t " << elapsed.count() << "\t     "
+             << static_cast<size_t>(tree.entry_count() / elapsed.count()) << "\n";
+        if (jobs == max_jobs) break;
+    }
+}
+
 int main(int argc, char* argv[]) {
     if (argc < 2) {
-        cerr << "Usage: " << argv[0] << " <directory_path> [-a] [-d]\n";
+        cerr << "Usage: " << argv[0] << " <directory_path> [-a] [-d] [-j threads] [-c] [-s] [-f snapshot] [-l] [-t operations] [-u count] [-b]\n";
         return 1;
     }
 
     fs::path directory_path = argv[1];
     bool show_all = false;
     bool show_details = false;
+    bool benchmark = false;
+    bool compact = false;
+    bool streaming = false;
+    fs::path snapshot_file;
+    bool live = false;
+    size_t stress_operations = 0;
+    size_t top_subtrees = 0;
+    size_t jobs = 1;
 
     for (int i = 2; i < argc; ++i) {
         string arg = argv[i];
         if (arg == "-a") show_all = true;
         if (arg == "-d") show_details = true;
+        if (arg == "-b") benchmark = true;
+        if (arg == "-c") compact = true;
+        if (arg == "-s") streaming = true;
+        if (arg == "-l") live = true;
+        if (arg == "-t" && i + 1 < argc) stress_operations = strtoul(argv[++i], nullptr, 10);
+        if (arg == "-u" && i + 1 < argc) top_subtrees = max(1, atoi(argv[++i]));
+        if (arg == "-f" && i + 1 < argc) snapshot_file = argv[++i];
+        if (arg == "-j" && i + 1 < argc) jobs = max(1, atoi(argv[++i]));
     }
 
     try {
-        DirectoryTree tree(directory_path);
+        if (benchmark) {
+            // Without -j, scale up to the number of hardware threads.
+            size_t max_jobs = jobs > 1 ? jobs : max(1u, thread::hardware_concurrency());
+            run_scaling_benchmark(directory_path, max_jobs);
+            run_storage_benchmark(directory_path);
+            run_snapshot_benchmark(directory_path);
+            return 0;
+        }
+        if (top_subtrees > 0) {
+            run_disk_usage(directory_path, jobs, top_subtrees);
+            return 0;
+        }
+        if (stress_operations > 0) {
+            run_live_stress(directory_path, stress_operations);
+            return 0;
+        }
+        if (live) {
+            run_live_mode(directory_path, show_all, show_details);
+            return 0;
+        }
+        if (streaming) {
+            StreamingTreePrinter printer(show_all, show_details);
+            printer.print_tree(directory_path);
+            return 0;
+        }
+        if (!snapshot_file.empty()) {
+            CompactDirectoryTree tree = refresh_snapshot(directory_path, snapshot_file);
+            tree.print_tree(show_all, show_details);
+            return 0;
+        }
+        if (compact) {
+            // The arena is filled in walk order, so the compact engine builds serially.
+            CompactDirectoryTree tree(directory_path);
+            tree.print_tree(show_all, show_details);
+            return 0;
+        }
+        DirectoryTree tree(directory_path, jobs);
         tree.print_tree(show_all, show_details);
     } catch (const exception& e) {
         cerr << "Error: " << e.what() << "\n";
@@ -111,4 +1672,11 @@ int main(int argc, char* argv[]) {
 
     return 0;
 }
-// run like this -> ./directory_tree /home/user -a -d
\ No newline at end of file
+// run like this    -> ./directory_tree /home/user -a -d -j 8
+// compact storage  -> ./directory_tree /home/user -c -d
+// streaming        -> ./directory_tree /home/user -s -d
+// snapshot         -> ./directory_tree /home/user -d -f /tmp/home.snapshot
+// live             -> ./directory_tree /home/user -l   (then: list docs, details docs, stats, quit)
+// live stress test -> ./directory_tree /tmp -t 100000
+// disk usage       -> ./directory_tree /home/user -u 20 -j 8
+// benchmarks       -> ./directory_tree /home/user -b
\ No newline at end of file